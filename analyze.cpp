@@ -0,0 +1,370 @@
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "player.h"
+using namespace std;
+
+// Positions read ahead of the oldest one not yet written, per worker.
+#define WINDOWPERWORKER 16
+// Deepest search when calibrating ProbCut, unless -depth says otherwise.
+#define CALIBRATIONDEPTH 12
+
+// Searches a stream of positions, one per line as the 64 characters of
+// b/w/. that Board::setBoard() reads followed by the side to move (b or
+// w), and writes one line per position in input order:
+//
+//   <line> <best move> <score> <principal variation>
+//
+// with moves like d3 (column a-h, row 1-8) or "pass". The score is from
+// the side to move, as a disc difference when the endgame solver found
+// it; a finished game gives move "end" and the final disc difference.
+// Lines that are not positions give "<line> error". Each worker thread
+// has its own single-threaded players, which share the evaluation
+// weights, and clears its table before every position so that a result
+// does not depend on what the worker searched before. At most a fixed
+// window of positions is in memory at once, so any number of them can be
+// streamed through.
+//
+// With -calibrate, every position is instead searched full width at each
+// depth from 1 to -depth, without the endgame solver, and its line lists
+// those scores. For each phase and depth, the deep scores are fitted to
+// the scores of the shallow search ProbCut pairs with that depth, and the
+// fits are written to the given file for Player to read as PROBCUTFILE.
+//
+// Usage: analyze [-depth n | -time ms] [-threads n] [-hash MB]
+//                [-endgame empties] [-weights file] [-probcut file|none]
+//                [-calibrate file] [file]
+
+struct Job {
+    uint64_t line;
+    string board;
+    Side side;
+    bool valid;
+};
+
+static mutex queueLock;
+static condition_variable jobReady, slotFree;
+static deque<Job> jobs;
+static bool inputDone;
+
+// Results wait in a ring of window slots until every line before them has
+// been written; a line is only read once its slot is free.
+static vector<string> results;
+static vector<bool> ready;
+static uint64_t written;
+static unsigned int window;
+
+// Sums for the least squares fit of deep scores (y) to shallow ones (x),
+// by phase and deep depth.
+struct Fit {
+    double n, x, y, xx, xy, yy;
+};
+static Fit fits[EVALPHASES][MPCMAXDEPTH + 1];
+static const char *calibration;
+
+static PlayerShared *shared;
+static int depth = MINIMAXDEPTH;
+static int moveTime = 0;
+static int hashMB = SESSIONHASHMB;
+static int endgameEmpties = ENDGAMEEMPTIES;
+static const char *probCutPath;
+
+static string squareName(int square) {
+    if (square < 0) return "pass";
+    char name[3] = { (char) ('a' + square % 8), (char) ('1' + square / 8), 0 };
+    return name;
+}
+
+/*
+ * Searches one position with the player for its side to move. A side
+ * with no moves passes, and the position is searched for the opponent.
+ */
+static string analyze(const Job &job, Player *players[2]) {
+    char data[64];
+    memcpy(data, job.board.data(), 64);
+    Board board;
+    board.setBoard(data);
+
+    char out[32];
+    Side side = job.side;
+    bool pass = false;
+    if (board.getPossibleMoves(side) == 0) {
+        Side other = otherSide(side);
+        if (board.getPossibleMoves(other) == 0) {
+            int discs = board.countBlack() - board.countWhite();
+            snprintf(out, sizeof(out), "%llu end %d", (unsigned long long) job.line,
+                     side == BLACK ? discs : -discs);
+            return out;
+        }
+        side = other;
+        pass = true;
+    }
+
+    Player *player = players[side];
+    player->setBoard(data);
+    player->clearHash();
+    delete player->doMove(NULL, moveTime > 0 ? moveTime : -1);
+
+    const vector<int> &pv = player->getPV();
+    int score = pass ? -player->getScore() : player->getScore();
+    snprintf(out, sizeof(out), "%llu %s %d", (unsigned long long) job.line,
+             squareName(pass ? -1 : pv.empty() ? -1 : pv[0]).c_str(), score);
+    string line = out;
+    if (pass) {
+        line += " pass";
+    }
+    for (unsigned int i = 0; i < pv.size(); i++) {
+        line += " " + squareName(pv[i]);
+    }
+    return line;
+}
+
+/*
+ * Searches one position at every depth up to the calibration depth and
+ * adds each pair of depths ProbCut would use to the fits. Positions that
+ * are decided, or where the side to move has to pass, are skipped.
+ */
+static string calibrate(const Job &job, Player *players[2]) {
+    char data[64];
+    memcpy(data, job.board.data(), 64);
+    Board board;
+    board.setBoard(data);
+    string line = to_string(job.line);
+    if (board.getPossibleMoves(job.side) == 0) {
+        return line + " skip";
+    }
+
+    Player *player = players[job.side];
+    player->setBoard(data);
+    player->clearHash();
+    vector<int> scores(depth + 1);
+    for (int d = 1; d <= depth; d++) {
+        player->setSearchDepth(d);
+        player->setBoard(data);
+        delete player->doMove(NULL, -1);
+        scores[d] = player->getScore();
+        line += " " + to_string(scores[d]);
+    }
+
+    int phase = Evaluator::phase(board.own<BLACK>(), board.own<WHITE>());
+    lock_guard<mutex> guard(queueLock);
+    for (int d = MPCMINDEPTH; d <= min(depth, MPCMAXDEPTH); d++) {
+        double x = scores[ProbCut::shallowDepth(d)], y = scores[d];
+        if (fabs(x) >= WINSCORE / 2 || fabs(y) >= WINSCORE / 2) {
+            continue;
+        }
+        Fit &f = fits[phase][d];
+        f.n++;
+        f.x += x;
+        f.y += y;
+        f.xx += x * x;
+        f.xy += x * y;
+        f.yy += y * y;
+    }
+    return line;
+}
+
+/*
+ * Fits deep = a * shallow + b by least squares for every phase and depth
+ * with enough samples, and writes the fits and their residual standard
+ * deviations to the calibration file.
+ */
+static bool saveCalibration() {
+    ProbCut probCut;
+    for (int phase = 0; phase < EVALPHASES; phase++) {
+        for (int d = MPCMINDEPTH; d <= MPCMAXDEPTH; d++) {
+            const Fit &f = fits[phase][d];
+            double sxx = f.xx - f.x * f.x / f.n;
+            if (f.n < MPCMINSAMPLES || sxx <= 0) {
+                continue;
+            }
+            double sxy = f.xy - f.x * f.y / f.n;
+            double syy = f.yy - f.y * f.y / f.n;
+            ProbCutParams p;
+            p.shallow = ProbCut::shallowDepth(d);
+            p.a = sxy / sxx;
+            p.b = (f.y - p.a * f.x) / f.n;
+            p.sigma = sqrt(max(syy - p.a * sxy, 0.0) / (f.n - 2));
+            if (p.a <= 0) {
+                continue;
+            }
+            probCut.set(phase, d, p);
+            fprintf(stderr, "phase %d depth %2d from %2d: a %.3f b %7.1f sigma %6.1f"
+                    " (%.0f positions)\n", phase, d, p.shallow, p.a, p.b, p.sigma, f.n);
+        }
+    }
+    return probCut.save(calibration);
+}
+
+/*
+ * Takes positions off the queue until the input is done, and writes out
+ * every result that is now next in line.
+ */
+static void worker() {
+    Player *players[2];
+    for (int s = 0; s < 2; s++) {
+        players[s] = new Player((Side) s, shared);
+        players[s]->setThreads(1);
+        players[s]->setHashSize(hashMB);
+        players[s]->setBook(NULL);
+        players[s]->setEndgameEmpties(endgameEmpties);
+        players[s]->setSearchDepth(depth);
+        players[s]->setMoveTime(moveTime);
+        if (calibration) {
+            players[s]->setProbCut(NULL);
+            players[s]->setEndgameEmpties(0);
+        } else if (probCutPath) {
+            players[s]->setProbCut(strcmp(probCutPath, "none") ? probCutPath : NULL);
+        }
+    }
+
+    while (true) {
+        Job job;
+        {
+            unique_lock<mutex> guard(queueLock);
+            jobReady.wait(guard, [] { return inputDone || !jobs.empty(); });
+            if (jobs.empty()) break;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        string result = !job.valid ? to_string(job.line) + " error"
+                      : calibration ? calibrate(job, players) : analyze(job, players);
+
+        unique_lock<mutex> guard(queueLock);
+        results[(job.line - 1) % window] = result;
+        ready[(job.line - 1) % window] = true;
+        bool wrote = false;
+        while (ready[written % window]) {
+            string &line = results[written % window];
+            fwrite(line.data(), 1, line.size(), stdout);
+            fputc('\n', stdout);
+            line.clear();
+            ready[written % window] = false;
+            written++;
+            wrote = true;
+        }
+        if (wrote) {
+            fflush(stdout);
+            slotFree.notify_one();
+        }
+    }
+
+    delete players[BLACK];
+    delete players[WHITE];
+}
+
+/*
+ * Parses "<64 chars> <b|w>".
+ */
+static Job parse(uint64_t line, const string &text) {
+    Job job;
+    job.line = line;
+    job.valid = false;
+    size_t end = text.find_last_not_of(" \t\r");
+    if (end == string::npos || end < 65 || text[64] != ' ') return job;
+    job.board = text.substr(0, 64);
+    if (job.board.find_first_not_of("bw.- ") != string::npos) return job;
+    char side = text[end];
+    if (text.find_first_not_of(' ', 64) != end || (side != 'b' && side != 'w')) {
+        return job;
+    }
+    job.side = (side == 'b') ? BLACK : WHITE;
+    job.valid = true;
+    return job;
+}
+
+int main(int argc, char *argv[]) {
+    int threads = max((int) thread::hardware_concurrency(), 1);
+    const char *weights = NULL;
+    const char *path = NULL;
+    bool depthGiven = false;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "-depth") && more) {
+            depth = atoi(argv[++i]);
+            depthGiven = true;
+        } else if (!strcmp(argv[i], "-time") && more) {
+            moveTime = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            threads = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-hash") && more) {
+            hashMB = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-endgame") && more) {
+            endgameEmpties = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-weights") && more) {
+            weights = argv[++i];
+        } else if (!strcmp(argv[i], "-probcut") && more) {
+            probCutPath = argv[++i];
+        } else if (!strcmp(argv[i], "-calibrate") && more) {
+            calibration = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-depth n | -time ms] [-threads n] [-hash MB] "
+                    "[-endgame empties] [-weights file] [-probcut file|none] "
+                    "[-calibrate file] [file]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (calibration) {
+        depth = depthGiven ? max(depth, 1) : CALIBRATIONDEPTH;
+        moveTime = 0;
+    }
+
+    ifstream file;
+    if (path) {
+        file.open(path);
+        if (!file) {
+            perror(path);
+            return 1;
+        }
+    } else {
+        ios::sync_with_stdio(false);
+    }
+    istream &in = path ? (istream &) file : cin;
+
+    shared = new PlayerShared(0);
+    if (weights && !shared->eval.load(weights)) {
+        fprintf(stderr, "cannot read weights from %s\n", weights);
+        return 1;
+    }
+    window = threads * WINDOWPERWORKER;
+    results.resize(window);
+    ready.resize(window);
+    vector<thread> pool;
+    for (int i = 0; i < threads; i++) {
+        pool.push_back(thread(worker));
+    }
+
+    string text;
+    for (uint64_t line = 1; getline(in, text); line++) {
+        Job job = parse(line, text);
+        unique_lock<mutex> guard(queueLock);
+        slotFree.wait(guard, [line] { return line - 1 < written + window; });
+        jobs.push_back(job);
+        jobReady.notify_one();
+    }
+    {
+        lock_guard<mutex> guard(queueLock);
+        inputDone = true;
+    }
+    jobReady.notify_all();
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        pool[i].join();
+    }
+    delete shared;
+    if (calibration && !saveCalibration()) {
+        perror(calibration);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "board.h"
+#include "eval.h"
+using namespace std;
+
+// Positions in each corpus, the games they are drawn from, and the
+// empties that split the midgame from the endgame.
+#define CORPUSSIZE 4096
+#define CORPUSSEED 2015
+#define MIDGAMEEMPTIES 44
+#define ENDGAMEEMPTIESMAX 20
+// Timed samples per kernel, and the least time one sample takes.
+#define BENCHSAMPLES 15
+#define BENCHSAMPLEMS 20
+// A kernel regresses against a baseline when it is this much slower and
+// the difference is more than BENCHNOISE standard deviations.
+#define BENCHTOLERANCE 0.05
+#define BENCHNOISE 3.0
+
+// Times the board and evaluation kernels the search spends its time in,
+// each on a fixed corpus of midgame positions (21 to 44 empties) and one
+// of endgame positions (20 or fewer). The corpora come from games played
+// with a light policy (take a corner, avoid the squares next to empty
+// corners) and a fixed seed, so every build times the same positions.
+// Each kernel is timed BENCHSAMPLES times, each sample looping over its
+// corpus for at least BENCHSAMPLEMS; the kernels take turns from sample
+// to sample, so that a slow spell of the machine shows up as variance
+// in all of them rather than as a change in one. The median time per
+// call is reported with the standard deviation over the samples and the
+// calls per second.
+// "evaluate" is the call Player::evaluate() makes, from the search
+// thread's pattern state, and "evaluateFull" reads the patterns afresh.
+//
+// -json writes one JSON line per kernel and corpus instead of a table,
+// for saving and diffing. -compare reads such a file and flags every
+// kernel that has become slower by more than BENCHTOLERANCE beyond the
+// noise; the exit status is 1 if any has.
+//
+// Usage: benchmark [-json] [-samples n] [-compare file]
+
+struct Position {
+    Board board;
+    Side side;
+    Move move;
+    int square;
+    int index;
+
+    Position() : move(-1, -1) {}
+};
+
+// A kernel runs its call over the whole corpus the given number of
+// times; positions carry an index into states for the evaluation.
+struct Kernel {
+    const char *name;
+    const char *corpus;
+    function<uint64_t(int)> run;
+    int rounds;
+    vector<double> ns;
+};
+
+struct Result {
+    string kernel, corpus;
+    double ns, stddev;
+};
+
+static volatile uint64_t sink;
+
+static inline uint64_t nextRandom(uint64_t &state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Plays reproducible light-policy games and keeps positions with
+ * between minEmpties and maxEmpties empty squares where the side to move
+ * has a move, with the move that was played, until there are
+ * CORPUSSIZE.
+ */
+static vector<Position> makeCorpus(int minEmpties, int maxEmpties, uint64_t seed,
+                                   vector<EvalState> &states) {
+    static const uint64_t CORNERS = 0x8100000000000081ULL;
+    static const uint64_t NEXTTOCORNER[4][2] = {
+        { 0x0000000000000001ULL, 0x0000000000000302ULL },
+        { 0x0000000000000080ULL, 0x000000000000c040ULL },
+        { 0x0100000000000000ULL, 0x0203000000000000ULL },
+        { 0x8000000000000000ULL, 0x40c0000000000000ULL }
+    };
+    vector<Position> corpus;
+    uint64_t rng = seed;
+    while (corpus.size() < CORPUSSIZE) {
+        Board board;
+        Side side = BLACK;
+        while (!board.isDone() && corpus.size() < CORPUSSIZE) {
+            uint64_t moves = board.getPossibleMoves(side);
+            if (moves == 0) {
+                side = otherSide(side);
+                continue;
+            }
+            uint64_t empty = ~(board.own<BLACK>() | board.own<WHITE>());
+            uint64_t danger = 0;
+            for (int c = 0; c < 4; c++) {
+                if (empty & NEXTTOCORNER[c][0]) danger |= NEXTTOCORNER[c][1];
+            }
+            uint64_t choices = (moves & CORNERS) ? (moves & CORNERS)
+                             : (moves & ~danger) ? (moves & ~danger) : moves;
+            for (int k = nextRandom(rng) % __builtin_popcountll(choices); k > 0; k--) {
+                choices &= choices - 1;
+            }
+            int square = __builtin_ctzll(choices);
+
+            int empties = __builtin_popcountll(empty);
+            if (empties >= minEmpties && empties <= maxEmpties) {
+                Position p;
+                p.board = board;
+                p.side = side;
+                p.square = square;
+                p.move = Move(square % 8, square / 8);
+                p.index = corpus.size();
+                states.push_back(EvalState());
+                Evaluator::initState(states.back(), board.own<BLACK>(), board.own<WHITE>());
+                corpus.push_back(p);
+            }
+            board.makeMove(square, side);
+            side = otherSide(side);
+        }
+    }
+    return corpus;
+}
+
+/*
+ * A kernel that calls op on every position of the corpus, rounds times
+ * over, and returns the sum of the results so that nothing is optimised
+ * away.
+ */
+template <class Op>
+static Kernel kernel(const char *name, const char *corpusName, vector<Position> &corpus,
+                     Op op) {
+    Kernel k;
+    k.name = name;
+    k.corpus = corpusName;
+    k.rounds = 1;
+    k.run = [&corpus, op](int rounds) {
+        uint64_t acc = 0;
+        for (int r = 0; r < rounds; r++) {
+            for (unsigned int i = 0; i < corpus.size(); i++) {
+                acc += op(corpus[i]);
+            }
+        }
+        return acc;
+    };
+    return k;
+}
+
+/*
+ * Adds every kernel on one corpus. The evaluation kernels read each
+ * position's pattern state from states.
+ */
+static void addKernels(const char *name, vector<Position> &corpus, vector<EvalState> &states,
+                       Evaluator &eval, vector<Kernel> &kernels) {
+    kernels.push_back(kernel("getPossibleMoves", name, corpus, [](Position &p) {
+        return p.board.getPossibleMoves(p.side);
+    }));
+    kernels.push_back(kernel("hasMoves", name, corpus, [](Position &p) {
+        return (uint64_t) p.board.hasMoves(p.side);
+    }));
+    kernels.push_back(kernel("checkMove", name, corpus, [](Position &p) {
+        return (uint64_t) p.board.checkMove(&p.move, p.side);
+    }));
+    kernels.push_back(kernel("doMove", name, corpus, [](Position &p) {
+        Board b = p.board;
+        b.doMove(&p.move, p.side);
+        return b.own<BLACK>();
+    }));
+    kernels.push_back(kernel("makeMove", name, corpus, [](Position &p) {
+        uint64_t flips = p.board.makeMove(p.square, p.side);
+        p.board.unmakeMove(p.square, flips, p.side);
+        return flips;
+    }));
+    kernels.push_back(kernel("copy", name, corpus, [](Position &p) {
+        Board *b = p.board.copy();
+        uint64_t black = b->own<BLACK>();
+        delete b;
+        return black;
+    }));
+    kernels.push_back(kernel("count", name, corpus, [](Position &p) {
+        return (uint64_t) p.board.count(p.side);
+    }));
+    kernels.push_back(kernel("evaluate", name, corpus, [&eval, &states](Position &p) {
+        uint64_t black = p.board.own<BLACK>(), white = p.board.own<WHITE>();
+        if (p.side == BLACK) {
+            return (uint64_t) eval.evaluate<BLACK>(states[p.index], black, white);
+        }
+        return (uint64_t) eval.evaluate<WHITE>(states[p.index], white, black);
+    }));
+    kernels.push_back(kernel("evaluateFull", name, corpus, [&eval](Position &p) {
+        uint64_t P = (p.side == BLACK) ? p.board.own<BLACK>() : p.board.own<WHITE>();
+        uint64_t O = (p.side == BLACK) ? p.board.own<WHITE>() : p.board.own<BLACK>();
+        return (uint64_t) eval.evaluate(P, O);
+    }));
+}
+
+/*
+ * Times every kernel: one untimed run each to size its samples, then
+ * the samples, taking turns.
+ */
+static vector<Result> measure(vector<Kernel> &kernels, int samples) {
+    typedef chrono::steady_clock clock;
+    uint64_t acc = 0;
+    for (unsigned int k = 0; k < kernels.size(); k++) {
+        clock::time_point start = clock::now();
+        acc += kernels[k].run(1);
+        double once = chrono::duration<double, milli>(clock::now() - start).count();
+        kernels[k].rounds = max(1, (int) ceil(BENCHSAMPLEMS / max(once, 1e-3)));
+    }
+    for (int s = 0; s < samples; s++) {
+        for (unsigned int k = 0; k < kernels.size(); k++) {
+            clock::time_point start = clock::now();
+            acc += kernels[k].run(kernels[k].rounds);
+            double ns = chrono::duration<double, nano>(clock::now() - start).count();
+            kernels[k].ns.push_back(ns / ((double) kernels[k].rounds * CORPUSSIZE));
+        }
+    }
+    sink = sink + acc;
+
+    vector<Result> results;
+    for (unsigned int k = 0; k < kernels.size(); k++) {
+        vector<double> &ns = kernels[k].ns;
+        double mean = 0, variance = 0;
+        for (int s = 0; s < samples; s++) mean += ns[s] / samples;
+        for (int s = 0; s < samples; s++) variance += (ns[s] - mean) * (ns[s] - mean);
+        sort(ns.begin(), ns.end());
+
+        Result r;
+        r.kernel = kernels[k].name;
+        r.corpus = kernels[k].corpus;
+        r.ns = ns[samples / 2];
+        r.stddev = (samples > 1) ? sqrt(variance / (samples - 1)) : 0;
+        results.push_back(r);
+    }
+    return results;
+}
+
+/*
+ * Reads results written with -json. Lines that do not parse are skipped.
+ */
+static vector<Result> readResults(const char *path) {
+    vector<Result> results;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return results;
+    }
+    char line[512], kernel[64], corpus[64];
+    while (fgets(line, sizeof(line), f)) {
+        Result r;
+        if (sscanf(line, "{\"kernel\":\"%63[^\"]\",\"corpus\":\"%63[^\"]\",\"ns\":%lf,"
+                   "\"stddev\":%lf", kernel, corpus, &r.ns, &r.stddev) == 4) {
+            r.kernel = kernel;
+            r.corpus = corpus;
+            results.push_back(r);
+        }
+    }
+    fclose(f);
+    return results;
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    int samples = BENCHSAMPLES;
+    const char *baseline = NULL;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "-json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "-samples") && more) {
+            samples = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-compare") && more) {
+            baseline = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-json] [-samples n] [-compare file]\n", argv[0]);
+            return 2;
+        }
+    }
+    vector<Result> base;
+    if (baseline) {
+        base = readResults(baseline);
+        if (base.empty()) {
+            fprintf(stderr, "no results in %s\n", baseline);
+            return 1;
+        }
+    }
+
+    Evaluator eval;
+    eval.load(EVALFILE);
+    vector<EvalState> midgameStates, endgameStates;
+    vector<Position> midgame = makeCorpus(ENDGAMEEMPTIESMAX + 1, MIDGAMEEMPTIES, CORPUSSEED,
+                                          midgameStates);
+    vector<Position> endgame = makeCorpus(0, ENDGAMEEMPTIESMAX, CORPUSSEED + 1, endgameStates);
+    vector<Kernel> kernels;
+    addKernels("midgame", midgame, midgameStates, eval, kernels);
+    addKernels("endgame", endgame, endgameStates, eval, kernels);
+    vector<Result> results = measure(kernels, samples);
+
+    const char *backend = Board::backendName(Board::getBackend());
+    if (!json) {
+        printf("move generation: %s, %d positions per corpus, %d samples\n",
+               backend, CORPUSSIZE, samples);
+        printf("%-18s %-8s %9s %8s %6s %12s%s\n", "kernel", "corpus", "ns/op", "stddev",
+               "cv", "ops/s", baseline ? "   change" : "");
+    }
+    int regressions = 0;
+    for (unsigned int i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        if (json) {
+            printf("{\"kernel\":\"%s\",\"corpus\":\"%s\",\"ns\":%.3f,\"stddev\":%.3f,"
+                   "\"opspersec\":%.0f,\"samples\":%d,\"backend\":\"%s\"}\n",
+                   r.kernel.c_str(), r.corpus.c_str(), r.ns, r.stddev, 1e9 / r.ns,
+                   samples, backend);
+            continue;
+        }
+        printf("%-18s %-8s %9.3f %8.3f %5.1f%% %12.0f", r.kernel.c_str(), r.corpus.c_str(),
+               r.ns, r.stddev, 100 * r.stddev / r.ns, 1e9 / r.ns);
+        for (unsigned int j = 0; j < base.size(); j++) {
+            const Result &b = base[j];
+            if (b.kernel != r.kernel || b.corpus != r.corpus) continue;
+            double noise = BENCHNOISE * sqrt(r.stddev * r.stddev + b.stddev * b.stddev);
+            bool slower = r.ns > b.ns * (1 + BENCHTOLERANCE) && r.ns - b.ns > noise;
+            printf("  %+6.1f%%%s", 100 * (r.ns / b.ns - 1), slower ? "  REGRESSION" : "");
+            regressions += slower;
+        }
+        printf("\n");
+    }
+    return regressions > 0;
+}
@@ -1,96 +1,339 @@
 #include "board.h"
+#include "movegen.h"
 
-bitset<64> WEST = bitset<64>(0x7f7f7f7f7f7f7f7fULL);
-bitset<64> EAST = bitset<64>(0xfefefefefefefefeULL);
+// Opponent mask for horizontal and diagonal runs. Dropping the A and H
+// files stops a run from wrapping onto the neighbouring row when shifted.
+#define INNER 0x7e7e7e7e7e7e7e7eULL
+
+#define FILEA 0x0101010101010101ULL
+#define FILEH 0x8080808080808080ULL
+#define RANK1 0x00000000000000ffULL
+#define RANK8 0xff00000000000000ULL
+#define BORDER (FILEA | FILEH | RANK1 | RANK8)
 
 /*
- * Shows valid positions to play in each direction: North, 
- * South, East, or West. Treats board configuration as a 
- * bitboard.
+ * Zobrist keys, generated with splitmix64 at compile time so the table is
+ * constant-initialized and usable from any static constructor. Keys 0-63
+ * are black discs, 64-127 white discs and 128 is white to move.
  */
-bitset<64> N(bitset<64> x) {
-    return x << 8;
+static constexpr uint64_t splitmix3(uint64_t z) {
+    return z ^ (z >> 31);
 }
 
-bitset<64> S(bitset<64> x) {
-    return x >> 8;
+static constexpr uint64_t splitmix2(uint64_t z) {
+    return splitmix3((z ^ (z >> 27)) * 0x94d049bb133111ebULL);
 }
 
-// Have to use strings because 64 bits is larger than long integers.
-bitset<64> W(bitset<64> x) {
-    return (x & WEST) << 1;
+static constexpr uint64_t splitmix(uint64_t z) {
+    return splitmix2((z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL);
 }
 
-bitset<64> E(bitset<64> x) {
-    return (x & EAST) >> 1;
+#define Z1(n) splitmix(0x9e3779b97f4a7c15ULL * ((n) + 1))
+#define Z4(n) Z1(n), Z1(n + 1), Z1(n + 2), Z1(n + 3)
+#define Z16(n) Z4(n), Z4(n + 4), Z4(n + 8), Z4(n + 12)
+#define Z64(n) Z16(n), Z16(n + 16), Z16(n + 32), Z16(n + 48)
+
+const uint64_t ZOBRIST[ZOBRISTKEYS] = { Z64(0), Z64(64), Z1(128) };
+
+#define BLACKKEY(sq) ZOBRIST[(sq)]
+#define WHITEKEY(sq) ZOBRIST[64 + (sq)]
+#define SIDEKEY ZOBRIST[128]
+
+/*
+ * Shifts a bitboard by S squares: positive shifts move towards bit 63,
+ * negative shifts towards bit 0. +/-1 is a column, +/-8 a row and
+ * +/-7, +/-9 the diagonals.
+ */
+template <int S>
+static inline uint64_t shift(uint64_t x) {
+    return (S > 0) ? (x << (S & 63)) : (x >> ((-S) & 63));
 }
 
 /*
- * Make a standard 8x8 othello board and initialize it to the standard setup.
+ * Kogge-Stone occluded fill in direction S. Starting from gen, extends
+ * every run through the squares in pro; after the three doubling steps
+ * runs of up to eight squares are covered, which is enough for an 8x8
+ * board.
  */
-Board::Board() {
-    taken.set(3 + 8 * 3);
-    taken.set(3 + 8 * 4);
-    taken.set(4 + 8 * 3);
-    taken.set(4 + 8 * 4);
+template <int S>
+static inline uint64_t fill(uint64_t gen, uint64_t pro) {
+    gen |= pro & shift<S>(gen);
+    pro &= shift<S>(pro);
+    gen |= pro & shift<2 * S>(gen);
+    pro &= shift<2 * S>(pro);
+    gen |= pro & shift<4 * S>(gen);
+    return gen;
+}
 
-    black.set(4 + 8 * 3);
-    black.set(3 + 8 * 4);
+/*
+ * Moves in direction S: empty squares reached by stepping off a run of
+ * one or more opponent discs that starts next to one of our discs.
+ */
+template <int S>
+static inline uint64_t movesDir(uint64_t P, uint64_t O, uint64_t empty) {
+    uint64_t run = fill<S>(shift<S>(P) & O, O);
+    return shift<S>(run) & empty;
 }
 
 /*
- * Destructor for the board.
+ * Discs flipped in direction S by playing the square m. The run of
+ * opponent discs is kept only if it is capped by one of our discs; the
+ * select is done with a mask rather than a branch.
  */
-Board::~Board() {
+template <int S>
+static inline uint64_t flipsDir(uint64_t m, uint64_t P, uint64_t O) {
+    uint64_t run = fill<S>(m, O);
+    uint64_t capped = -(uint64_t)((shift<S>(run) & P) != 0);
+    return run & ~m & capped;
 }
 
 /*
- * Returns a copy of this board.
+ * Generates all legal moves for player against opponent. Based on the
+ * directional shifts described at
+ * https://reversiworld.wordpress.com/2013/11/05/generating-moves-using-bitboard/
+ * but with each direction done as a Kogge-Stone fill instead of a loop.
  */
-Board *Board::copy() {
-    Board *newBoard = new Board();
-    newBoard->black = black;
-    newBoard->taken = taken;
-    return newBoard;
+static uint64_t getMovesScalar(uint64_t P, uint64_t O) {
+    uint64_t empty = ~(P | O);
+    uint64_t inner = O & INNER;
+    return movesDir<8>(P, O, empty)
+         | movesDir<-8>(P, O, empty)
+         | movesDir<1>(P, inner, empty)
+         | movesDir<-1>(P, inner, empty)
+         | movesDir<9>(P, inner, empty)
+         | movesDir<7>(P, inner, empty)
+         | movesDir<-7>(P, inner, empty)
+         | movesDir<-9>(P, inner, empty);
+}
+
+/*
+ * Returns the set of opponent discs flipped by player playing square,
+ * computed for all eight directions in one pass. An empty result on an
+ * empty square means the move is illegal.
+ */
+static uint64_t getFlipsScalar(int square, uint64_t P, uint64_t O) {
+    uint64_t m = 1ULL << square;
+    uint64_t inner = O & INNER;
+    return flipsDir<8>(m, P, O)
+         | flipsDir<-8>(m, P, O)
+         | flipsDir<1>(m, P, inner)
+         | flipsDir<-1>(m, P, inner)
+         | flipsDir<9>(m, P, inner)
+         | flipsDir<7>(m, P, inner)
+         | flipsDir<-7>(m, P, inner)
+         | flipsDir<-9>(m, P, inner);
+}
+
+/*
+ * The kernels of each backend. The scalar one is always available and is
+ * used until the best backend has been picked.
+ */
+typedef uint64_t (*MovesKernel)(uint64_t, uint64_t);
+typedef uint64_t (*FlipsKernel)(int, uint64_t, uint64_t);
+typedef void (*BothMovesKernel)(uint64_t, uint64_t, uint64_t &, uint64_t &);
+
+/*
+ * Both sides' moves from a backend without a kernel of its own for them.
+ */
+template <MovesKernel K>
+static void getBothMoves(uint64_t P, uint64_t O, uint64_t &movesP, uint64_t &movesO) {
+    movesP = K(P, O);
+    movesO = K(O, P);
+}
+
+static const MovesKernel MOVESKERNELS[BACKENDS] = {
+    getMovesScalar, getMovesAVX2, getMovesBMI2, getMovesAVX2
+};
+static const BothMovesKernel BOTHMOVESKERNELS[BACKENDS] = {
+    getBothMoves<getMovesScalar>, getBothMovesAVX2, getBothMoves<getMovesBMI2>,
+    getBothMovesAVX2
+};
+static const FlipsKernel FLIPSKERNELS[BACKENDS] = {
+    getFlipsScalar, getFlipsAVX2, getFlipsBMI2, getFlipsBMI2
+};
+static const char *BACKENDNAMES[BACKENDS] = { "scalar", "avx2", "bmi2", "avx2+bmi2" };
+
+static int backend = BACKENDSCALAR;
+static MovesKernel movesKernel = getMovesScalar;
+static BothMovesKernel bothMovesKernel = getBothMoves<getMovesScalar>;
+static FlipsKernel flipsKernel = getFlipsScalar;
+
+/*
+ * Picks the backend for this CPU before main() runs, from what CPUID
+ * reports. Flips come from the PEXT lookup wherever PEXT runs in
+ * hardware, which rules out AMD before Zen 3, and moves from the AVX2
+ * fills. The PEXT move lookup goes through some thirty lines one at a
+ * time and measured slower than even the scalar fills (see testmovegen),
+ * so it is only used when asked for.
+ */
+static int pickBackend() {
+    if (cpuHasAVX2() && cpuHasFastBMI2()) {
+        Board::setBackend(BACKENDMIXED);
+    } else if (cpuHasAVX2()) {
+        Board::setBackend(BACKENDAVX2);
+    }
+    return 0;
+}
+
+static int picked = pickBackend();
+
+/*
+ * Returns true if this CPU can run the given backend.
+ */
+bool Board::backendSupported(int which) {
+    switch (which) {
+    case BACKENDSCALAR:
+        return true;
+    case BACKENDAVX2:
+        return cpuHasAVX2();
+    case BACKENDBMI2:
+        return cpuHasFastBMI2();
+    case BACKENDMIXED:
+        return cpuHasAVX2() && cpuHasFastBMI2();
+    }
+    return false;
+}
+
+/*
+ * Switches every board to the given backend. Returns false, leaving the
+ * current one, if this CPU cannot run it. Not safe while other threads
+ * are generating moves.
+ */
+bool Board::setBackend(int which) {
+    if (!backendSupported(which)) {
+        return false;
+    }
+    backend = which;
+    movesKernel = MOVESKERNELS[which];
+    bothMovesKernel = BOTHMOVESKERNELS[which];
+    flipsKernel = FLIPSKERNELS[which];
+    return true;
+}
+
+int Board::getBackend() {
+    return backend;
+}
+
+const char *Board::backendName(int which) {
+    return BACKENDNAMES[which];
+}
+
+uint64_t Board::getMoves(uint64_t P, uint64_t O) {
+    return movesKernel(P, O);
+}
+
+/*
+ * The moves of both sides, for about the price of one getMoves() call.
+ */
+void Board::getMoves(uint64_t P, uint64_t O, uint64_t &movesP, uint64_t &movesO) {
+    bothMovesKernel(P, O, movesP, movesO);
+}
+
+uint64_t Board::getFlips(int square, uint64_t P, uint64_t O) {
+    return flipsKernel(square, P, O);
+}
+
+/*
+ * Stable discs along the edges: the discs of a full edge, and runs of
+ * player discs reaching out from a corner. Cheap, and a subset of what
+ * getStable() finds.
+ */
+uint64_t Board::getStableEdges(uint64_t P, uint64_t O) {
+    uint64_t occupied = P | O;
+    uint64_t stable = 0;
+    if ((occupied & RANK1) == RANK1) stable |= P & RANK1;
+    if ((occupied & RANK8) == RANK8) stable |= P & RANK8;
+    if ((occupied & FILEA) == FILEA) stable |= P & FILEA;
+    if ((occupied & FILEH) == FILEH) stable |= P & FILEH;
+
+    uint64_t a1 = P & 0x1ULL, h1 = P & 0x80ULL;
+    uint64_t a8 = P & 0x0100000000000000ULL, h8 = P & 0x8000000000000000ULL;
+    stable |= fill<1>(a1, P & RANK1) | fill<-1>(h1, P & RANK1)
+            | fill<1>(a8, P & RANK8) | fill<-1>(h8, P & RANK8)
+            | fill<8>(a1, P & FILEA) | fill<-8>(a8, P & FILEA)
+            | fill<8>(h1, P & FILEH) | fill<-8>(h8, P & FILEH);
+    return stable;
+}
+
+/*
+ * Discs of player that can never be flipped, as a lower bound. A disc is
+ * stable if along each of the four lines through it either the line is
+ * full, one end of the line is off the board, or its neighbour on one
+ * side is itself stable. Starting from the stable edges, this is applied
+ * until nothing changes, which floods stability in from the corners.
+ */
+uint64_t Board::getStable(uint64_t P, uint64_t O) {
+    uint64_t empty = ~(P | O);
+
+    // Lines with no empty square on them. Empties are spread along each
+    // line in both directions; every square they miss is on a full line.
+    uint64_t fullH = ~(fill<1>(empty, ~FILEA) | fill<-1>(empty, ~FILEH));
+    uint64_t fullV = ~(fill<8>(empty, ~0ULL) | fill<-8>(empty, ~0ULL));
+    uint64_t fullD9 = ~(fill<9>(empty, ~FILEA) | fill<-9>(empty, ~FILEH));
+    uint64_t fullD7 = ~(fill<7>(empty, ~FILEH) | fill<-7>(empty, ~FILEA));
+
+    // Squares safe along a line whatever their neighbours are. Shifting
+    // a stable disc can wrap onto the other side of the board, but only
+    // onto border squares, which are safe anyway.
+    fullH |= FILEA | FILEH;
+    fullV |= RANK1 | RANK8;
+    fullD9 |= BORDER;
+    fullD7 |= BORDER;
+
+    uint64_t stable = getStableEdges(P, O);
+    uint64_t old;
+    do {
+        old = stable;
+        stable |= P & (fullH | (stable << 1) | (stable >> 1))
+                    & (fullV | (stable << 8) | (stable >> 8))
+                    & (fullD9 | (stable << 9) | (stable >> 9))
+                    & (fullD7 | (stable << 7) | (stable >> 7));
+    } while (stable != old);
+    return stable;
 }
 
-bool Board::occupied(int x, int y) {
-    return taken[x + 8*y];
+/*
+ * Number of side's discs that can never be flipped (a lower bound).
+ */
+int Board::getStablePieceCount(Side side) {
+    return __builtin_popcountll(getStable(own(side), opp(side)));
 }
 
-bool Board::get(Side side, int x, int y) {
-    return occupied(x, y) && (black[x + 8*y] == (side == BLACK));
+/*
+ * Make a standard 8x8 othello board and initialize it to the standard setup.
+ */
+Board::Board() {
+    black = (1ULL << (4 + 8 * 3)) | (1ULL << (3 + 8 * 4));
+    white = (1ULL << (3 + 8 * 3)) | (1ULL << (4 + 8 * 4));
+    computeKey();
 }
 
-void Board::set(Side side, int x, int y) {
-    taken.set(x + 8*y);
-    black.set(x + 8*y, side == BLACK);
+/*
+ * Destructor for the board.
+ */
+Board::~Board() {
 }
 
-bool Board::onBoard(int x, int y) {
-    return(0 <= x && x < 8 && 0 <= y && y < 8);
+/*
+ * Returns a copy of this board.
+ */
+Board *Board::copy() {
+    return new Board(*this);
 }
 
- 
 /*
- * Returns true if the game is finished; false otherwise. The game is finished 
+ * Returns true if the game is finished; false otherwise. The game is finished
  * if neither side has a legal move.
  */
 bool Board::isDone() {
-    return !(hasMoves(BLACK) || hasMoves(WHITE));
+    return (getMoves(black, white) | getMoves(white, black)) == 0;
 }
 
 /*
  * Returns true if there are legal moves for the given side.
  */
 bool Board::hasMoves(Side side) {
-    for (int i = 0; i < 8; i++) {
-        for (int j = 0; j < 8; j++) {
-            Move move(i, j);
-            if (checkMove(&move, side)) return true;
-        }
-    }
-    return false;
+    return getPossibleMoves(side) != 0;
 }
 
 /*
@@ -100,31 +343,12 @@ bool Board::checkMove(Move *m, Side side) {
     // Passing is only legal if you have no moves.
     if (m == NULL) return !hasMoves(side);
 
-    int X = m->getX();
-    int Y = m->getY();
+    int square = m->getX() + 8 * m->getY();
 
     // Make sure the square hasn't already been taken.
-    if (occupied(X, Y)) return false;
-
-    Side other = (side == BLACK) ? WHITE : BLACK;
-    for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-            if (dy == 0 && dx == 0) continue;
-
-            // Is there a capture in that direction?
-            int x = X + dx;
-            int y = Y + dy;
-            if (onBoard(x, y) && get(other, x, y)) {
-                do {
-                    x += dx;
-                    y += dy;
-                } while (onBoard(x, y) && get(other, x, y));
-
-                if (onBoard(x, y) && get(side, x, y)) return true;
-            }
-        }
-    }
-    return false;
+    if ((black | white) & (1ULL << square)) return false;
+
+    return getFlips(square, own(side), opp(side)) != 0;
 }
 
 /*
@@ -134,37 +358,31 @@ void Board::doMove(Move *m, Side side) {
     // A NULL move means pass.
     if (m == NULL) return;
 
-    // Ignore if move is invalid.
-    if (!checkMove(m, side)) return;
-
-    int X = m->getX();
-    int Y = m->getY();
-    Side other = (side == BLACK) ? WHITE : BLACK;
-    for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-            if (dy == 0 && dx == 0) continue;
-
-            int x = X;
-            int y = Y;
-            do {
-                x += dx;
-                y += dy;
-            } while (onBoard(x, y) && get(other, x, y));
-
-            if (onBoard(x, y) && get(side, x, y)) {
-                x = X;
-                y = Y;
-                x += dx;
-                y += dy;
-                while (onBoard(x, y) && get(other, x, y)) {
-                    set(side, x, y);
-                    x += dx;
-                    y += dy;
-                }
-            }
-        }
+    int square = m->getX() + 8 * m->getY();
+    if ((black | white) & (1ULL << square)) return;
+
+    // Ignore if move is invalid, i.e. it flips nothing.
+    makeMove(square, side);
+}
+
+/*
+ * Plays square for the given side and returns the discs it flipped, so
+ * the move can be taken back with unmakeMove(). The square must be empty;
+ * if the move flips nothing the board is left unchanged and 0 is returned.
+ */
+uint64_t Board::makeMove(int square, Side side) {
+    return (side == BLACK) ? makeMove<BLACK>(square) : makeMove<WHITE>(square);
+}
+
+/*
+ * Takes back a move made with makeMove(), given the flips it returned.
+ */
+void Board::unmakeMove(int square, uint64_t flips, Side side) {
+    if (side == BLACK) {
+        unmakeMove<BLACK>(square, flips);
+    } else {
+        unmakeMove<WHITE>(square, flips);
     }
-    set(side, X, Y);
 }
 
 /*
@@ -178,127 +396,40 @@ int Board::count(Side side) {
  * Current count of black stones.
  */
 int Board::countBlack() {
-    return black.count();
+    return __builtin_popcountll(black);
 }
 
 /*
  * Current count of white stones.
  */
 int Board::countWhite() {
-    return taken.count() - black.count();
+    return __builtin_popcountll(white);
 }
 
 /*
  * Generates all valid moves for a specific side, returning
- * a bitset to optimize performance.
+ * a bitboard with one bit set per legal square.
  */
-bitset<64> Board::getPossibleMoves(Side side) {
-    bitset<64> own;
-    bitset<64> opp;
-    if (side == BLACK) {
-	    own = black;
-	    opp = taken & (~black);
-    } else {
-	    own = taken & (~black);
-	    opp = black;
-    }
-
-    bitset<64> moves(0x0);
-    
-    // Gets all moves possible by playing above an enemy piece
-    bitset<64> possible = N(own) & opp;
-    for (int i = 0; i <= 4; ++i) {
-    	possible |= N(possible) & opp;
-    }
-    moves |= N(possible) & (~taken);
-    
-    // Gets all moves possible by playing below an enemy piece
-    possible = S(own) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= S(possible) & opp;
-    }
-    moves |= S(possible) & (~taken);
-    
-    // Gets all moves possible by playing right of an enemy piece
-    possible = E(own) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= E(possible) & opp;
-    }
-    moves |= E(possible) & (~taken);
-    
-    // Gets all moves possible by playing left of an enemy piece
-    possible = W(own) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= W(possible) & opp;
-    }
-    moves |= W(possible) & (~taken);
-    
-    // Gets all moves possible by playing diagonally right above 
-    // an enemy piece
-    possible = N(E(own)) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= N(E(possible)) & opp;
-    }
+uint64_t Board::getPossibleMoves(Side side) {
+    return getMoves(own(side), opp(side));
+}
 
-    moves |= N(E(possible)) & (~taken);
-    
-    // Gets all moves possible by playing diagonally left above 
-    // an enemy piece
-    possible = N(W(own)) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= N(W(possible)) & opp;
-    }
-    moves |= N(W(possible)) & (~taken);
-    
-    // Gets all moves possible by playing diagonally right below 
-    // an enemy piece
-    possible = S(E(own)) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= S(E(possible)) & opp;
-    }
-    moves |= S(E(possible)) & (~taken); 
+/*
+ * Returns the Zobrist key of this position with toMove to play.
+ */
+uint64_t Board::getKey(Side toMove) {
+    return (toMove == WHITE) ? (key ^ SIDEKEY) : key;
+}
 
-    // Gets all moves possible by playing diagonally left below 
-    // an enemy piece
-    possible = S(W(own)) & opp;
-    for (int i = 0; i <= 4; ++i) {
-	    possible |= S(W(possible)) & opp;
-    }
-    moves |= S(W(possible)) & (~taken);
-    
-    /* FOR DEBUGGING
-    for (unsigned int i = 0; i < taken.size(); ++i) {
-	if (taken.test(i)) {
-	    if (black.test(i)) {
-		cerr << "B";
-	    }
-	    else {
-		cerr << "W";
-	    }
-	}
-	else {
-	    cerr << "0";
-	}
-	if (i % 8 == 7) {
-	    cerr << endl;
-	}
-    }
-    cerr << endl;
-
-    for (unsigned int i = 0; i < moves.size(); ++i) {
-	if (moves.test(i)) {
-	    cerr << "1";
-	}
-	else {
-	    cerr << "0";
-	}
-	if (i % 8 == 7) {
-	    cerr << endl;
-	}
+/*
+ * Recomputes the Zobrist key from scratch.
+ */
+void Board::computeKey() {
+    key = 0;
+    for (int i = 0; i < 64; i++) {
+        if (black & (1ULL << i)) key ^= BLACKKEY(i);
+        if (white & (1ULL << i)) key ^= WHITEKEY(i);
     }
-    cerr << endl;
-    */
-    return moves;
 }
 
 /*
@@ -306,14 +437,39 @@ bitset<64> Board::getPossibleMoves(Side side) {
  * piece and 'b' indicates a black piece. Mainly for testing purposes.
  */
 void Board::setBoard(char data[]) {
-    taken.reset();
-    black.reset();
+    black = 0;
+    white = 0;
     for (int i = 0; i < 64; i++) {
         if (data[i] == 'b') {
-            taken.set(i);
-            black.set(i);
+            black |= 1ULL << i;
         } if (data[i] == 'w') {
-            taken.set(i);
+            white |= 1ULL << i;
+        }
+    }
+    computeKey();
+}
+
+/*
+ * Sets the board from the black and white disc masks.
+ */
+void Board::setDiscs(uint64_t black, uint64_t white) {
+    this->black = black;
+    this->white = white;
+    computeKey();
+}
+
+/*
+ * Writes the board state into an 8x8 char array in the format setBoard()
+ * reads: 'b' for black, 'w' for white and ' ' for an empty square.
+ */
+void Board::getBoard(char data[]) {
+    for (int i = 0; i < 64; i++) {
+        if (black & (1ULL << i)) {
+            data[i] = 'b';
+        } else if (white & (1ULL << i)) {
+            data[i] = 'w';
+        } else {
+            data[i] = ' ';
         }
     }
 }
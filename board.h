@@ -1,36 +1,143 @@
 #ifndef __BOARD_H__
 #define __BOARD_H__
 
-#include <bitset>
+#include <cstdint>
 #include "common.h"
 using namespace std;
 
+// Zobrist keys, defined in board.cpp: 0-63 for black discs, 64-127 for
+// white discs and 128 for white to move.
+#define ZOBRISTKEYS 129
+extern const uint64_t ZOBRIST[ZOBRISTKEYS];
+
 class Board {
     friend class Player;
+    friend struct SearchThread;
 private:
-    bitset<64> black;
-    bitset<64> taken;    
-
-    bool occupied(int x, int y);
-    bool get(Side side, int x, int y);
-    void set(Side side, int x, int y);
-    bool onBoard(int x, int y);
-      
+    uint64_t black;
+    uint64_t white;
+
+    // Zobrist key of the discs on the board, kept up to date by every
+    // move. The side to move is folded in by getKey().
+    uint64_t key;
+
+    void computeKey();
+
+    inline uint64_t own(Side side) { return (side == BLACK) ? black : white; }
+    inline uint64_t opp(Side side) { return (side == BLACK) ? white : black; }
+
+    // Key change for a move by side S on square that flipped the given
+    // discs. A flipped disc changes colour, so it toggles both of its keys.
+    template <Side S>
+    static inline uint64_t keyDelta(int square, uint64_t flips) {
+        uint64_t delta = ZOBRIST[(S == BLACK) ? square : 64 + square];
+        while (flips) {
+            int i = __builtin_ctzll(flips);
+            flips &= flips - 1;
+            delta ^= ZOBRIST[i] ^ ZOBRIST[64 + i];
+        }
+        return delta;
+    }
+
 public:
     Board();
     ~Board();
     Board *copy();
-        
+
     bool isDone();
     bool hasMoves(Side side);
     bool checkMove(Move *m, Side side);
     void doMove(Move *m, Side side);
+    uint64_t makeMove(int square, Side side);
+    void unmakeMove(int square, uint64_t flips, Side side);
     int count(Side side);
     int countBlack();
     int countWhite();
+    int getStablePieceCount(Side side);
 
-    bitset<64> getPossibleMoves(Side side);
+    uint64_t getPossibleMoves(Side side);
+    uint64_t getKey(Side toMove);
+    
+    // The same operations with the side fixed at compile time, for the
+    // search: nothing is left to branch on colour, and they inline.
+    template <Side S> inline uint64_t own() const { return (S == BLACK) ? black : white; }
+    template <Side S> inline uint64_t opp() const { return (S == BLACK) ? white : black; }
+    template <Side S> inline uint64_t getPossibleMoves() const {
+        return getMoves(own<S>(), opp<S>());
+    }
+    template <Side S> inline uint64_t getKey() const {
+        return (S == WHITE) ? (key ^ ZOBRIST[128]) : key;
+    }
+
+    template <Side S>
+    inline uint64_t makeMove(int square) {
+        uint64_t flips = getFlips(square, own<S>(), opp<S>());
+        if (flips == 0) return 0;
+        uint64_t placed = 1ULL << square;
+        if (S == BLACK) {
+            black ^= flips | placed;
+            white ^= flips;
+        } else {
+            white ^= flips | placed;
+            black ^= flips;
+        }
+        key ^= keyDelta<S>(square, flips);
+        return flips;
+    }
+
+    template <Side S>
+    inline void unmakeMove(int square, uint64_t flips) {
+        uint64_t placed = 1ULL << square;
+        if (S == BLACK) {
+            black ^= flips | placed;
+            white ^= flips;
+        } else {
+            white ^= flips | placed;
+            black ^= flips;
+        }
+        key ^= keyDelta<S>(square, flips);
+    }
     void setBoard(char data[]);
+    void setDiscs(uint64_t black, uint64_t white);
+    void getBoard(char data[]);
+
+    // Bitboard kernels on a (player, opponent) pair of disc masks.
+    static uint64_t getMoves(uint64_t player, uint64_t opponent);
+    static void getMoves(uint64_t player, uint64_t opponent,
+                         uint64_t &playerMoves, uint64_t &opponentMoves);
+    static uint64_t getFlips(int square, uint64_t player, uint64_t opponent);
+    static uint64_t getStable(uint64_t player, uint64_t opponent);
+
+    // Move generation backend shared by all boards (see movegen.h).
+    static bool backendSupported(int backend);
+    static bool setBackend(int backend);
+    static int getBackend();
+    static const char *backendName(int backend);
+    static uint64_t getStableEdges(uint64_t player, uint64_t opponent);
+
+    // Reflections of a bitboard; together they generate all eight
+    // symmetries of the board.
+    static inline uint64_t flipVertical(uint64_t b) {
+        return __builtin_bswap64(b);
+    }
+
+    static inline uint64_t mirrorHorizontal(uint64_t b) {
+        b = ((b >> 1) & 0x5555555555555555ULL) | ((b & 0x5555555555555555ULL) << 1);
+        b = ((b >> 2) & 0x3333333333333333ULL) | ((b & 0x3333333333333333ULL) << 2);
+        b = ((b >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((b & 0x0f0f0f0f0f0f0f0fULL) << 4);
+        return b;
+    }
+
+    static inline uint64_t flipDiagonal(uint64_t b) {
+        uint64_t t;
+        t = 0x0f0f0f0f00000000ULL & (b ^ (b << 28));
+        b ^= t ^ (t >> 28);
+        t = 0x3333000033330000ULL & (b ^ (b << 14));
+        b ^= t ^ (t >> 14);
+        t = 0x5500550055005500ULL & (b ^ (b << 7));
+        b ^= t ^ (t >> 7);
+        return b;
+    }
 };
 
 #endif
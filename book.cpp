@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "book.h"
+#include "board.h"
+
+using namespace std;
+
+static inline bool entryLess(const BookEntry &a, const BookEntry &b) {
+    return a.player < b.player || (a.player == b.player && a.opponent < b.opponent);
+}
+
+/*
+ * Creates an empty book.
+ */
+OpeningBook::OpeningBook() : _map(NULL), _mapSize(0), _entries(NULL), _count(0) {
+}
+
+/*
+ * Destructor for the book.
+ */
+OpeningBook::~OpeningBook() {
+    close();
+}
+
+/*
+ * Maps the book file at path, replacing any book already open. Returns
+ * false, leaving the book empty, if the file is missing or malformed.
+ */
+bool OpeningBook::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(BookHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const BookHeader *header = (const BookHeader *) map;
+    if (header->magic != BOOKMAGIC || (size_t) st.st_size !=
+            sizeof(BookHeader) + (size_t) header->count * sizeof(BookEntry)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    _map = map;
+    _mapSize = st.st_size;
+    _entries = (const BookEntry *) (header + 1);
+    _count = header->count;
+    return true;
+}
+
+/*
+ * Unmaps the book.
+ */
+void OpeningBook::close() {
+    if (_map) {
+        munmap(_map, _mapSize);
+    }
+    _map = NULL;
+    _mapSize = 0;
+    _entries = NULL;
+    _count = 0;
+}
+
+/*
+ * Applies one of the eight symmetries of the board to a bitboard:
+ * bit 0 of symmetry flips it vertically, bit 1 mirrors it and bit 2
+ * flips it along the diagonal, in that order.
+ */
+uint64_t OpeningBook::transform(uint64_t b, int symmetry) {
+    if (symmetry & 1) b = Board::flipVertical(b);
+    if (symmetry & 2) b = Board::mirrorHorizontal(b);
+    if (symmetry & 4) b = Board::flipDiagonal(b);
+    return b;
+}
+
+/*
+ * Undoes transform().
+ */
+uint64_t OpeningBook::untransform(uint64_t b, int symmetry) {
+    if (symmetry & 4) b = Board::flipDiagonal(b);
+    if (symmetry & 2) b = Board::mirrorHorizontal(b);
+    if (symmetry & 1) b = Board::flipVertical(b);
+    return b;
+}
+
+/*
+ * Replaces a position by its canonical image, the smallest of its eight
+ * symmetric images, and returns the symmetry that produced it.
+ */
+int OpeningBook::canonicalize(uint64_t &player, uint64_t &opponent) {
+    uint64_t bestP = player, bestO = opponent;
+    int best = 0;
+    for (int s = 1; s < 8; s++) {
+        uint64_t p = transform(player, s);
+        uint64_t o = transform(opponent, s);
+        if (p < bestP || (p == bestP && o < bestO)) {
+            bestP = p;
+            bestO = o;
+            best = s;
+        }
+    }
+    player = bestP;
+    opponent = bestO;
+    return best;
+}
+
+/*
+ * Looks up the position with player to move. On a hit stores the book
+ * move, as a square of the position given, and its score.
+ */
+bool OpeningBook::probe(uint64_t player, uint64_t opponent, int &move, int &score) {
+    if (_count == 0) {
+        return false;
+    }
+    int symmetry = canonicalize(player, opponent);
+
+    BookEntry key;
+    key.player = player;
+    key.opponent = opponent;
+    const BookEntry *end = _entries + _count;
+    const BookEntry *e = lower_bound(_entries, end, key, entryLess);
+    if (e == end || e->player != player || e->opponent != opponent) {
+        return false;
+    }
+    move = __builtin_ctzll(untransform(1ULL << e->move, symmetry));
+    score = e->score;
+    return true;
+}
+
+/*
+ * Sorts entries, which must already be canonical, and writes them as a
+ * book file. The file is written next to path and renamed over it, so
+ * players mapping the old book are not disturbed.
+ */
+bool OpeningBook::write(const char *path, BookEntry *entries, size_t count) {
+    sort(entries, entries + count, entryLess);
+
+    string tmp = string(path) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    BookHeader header;
+    header.magic = BOOKMAGIC;
+    header.count = count;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(entries, sizeof(BookEntry), count, f) == count;
+    ok = (fclose(f) == 0) && ok;
+    return ok && rename(tmp.c_str(), path) == 0;
+}
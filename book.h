@@ -0,0 +1,59 @@
+#ifndef __BOOK_H__
+#define __BOOK_H__
+
+#include <cstdint>
+#include <cstddef>
+
+#define BOOKFILE "opening.book"
+#define BOOKMAGIC 0x314b424fU
+
+/*
+ * One book position, stored from the side to move's point of view in
+ * canonical orientation (the smallest of its eight symmetric images).
+ * move is the best square in that orientation and score the searched
+ * value for the side to move.
+ */
+struct BookEntry {
+    uint64_t player;
+    uint64_t opponent;
+    int32_t score;
+    uint8_t move;
+    uint8_t depth;
+    uint16_t unused;
+};
+
+struct BookHeader {
+    uint32_t magic;
+    uint32_t count;
+};
+
+/*
+ * Read-only opening book. The file is a header followed by entries sorted
+ * by (player, opponent); it is mapped into memory as is and looked up by
+ * binary search, so opening it costs nothing beyond the mmap.
+ */
+class OpeningBook {
+
+private:
+    void *_map;
+    size_t _mapSize;
+    const BookEntry *_entries;
+    uint32_t _count;
+
+public:
+    OpeningBook();
+    ~OpeningBook();
+
+    bool open(const char *path);
+    void close();
+    size_t size() { return _count; }
+
+    bool probe(uint64_t player, uint64_t opponent, int &move, int &score);
+
+    static int canonicalize(uint64_t &player, uint64_t &opponent);
+    static uint64_t transform(uint64_t b, int symmetry);
+    static uint64_t untransform(uint64_t b, int symmetry);
+    static bool write(const char *path, BookEntry *entries, size_t count);
+};
+
+#endif
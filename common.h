@@ -14,6 +14,12 @@ enum Side {
     WHITE, BLACK
 };
 
+// The other side; a constant expression, so it can pick a template
+// specialisation.
+constexpr Side otherSide(Side s) {
+    return (s == BLACK) ? WHITE : BLACK;
+}
+
 class Move {
    
 public:
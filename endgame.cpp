@@ -0,0 +1,310 @@
+#include "endgame.h"
+#include "board.h"
+
+using namespace std;
+
+#define SOLVEINF 128
+
+// The stability cutoff is tried once alpha reaches this many discs per
+// empty square.
+#define STABILITYALPHA 2
+
+// The four quadrants of the board. Late in the game each quadrant tends
+// to become an isolated region, and moving into a region with an odd
+// number of empties lets us have the last move there.
+static const uint64_t QUADRANTS[4] = {
+    0x000000000f0f0f0fULL, 0x00000000f0f0f0f0ULL,
+    0x0f0f0f0f00000000ULL, 0xf0f0f0f000000000ULL
+};
+
+#define CORNERSQUARES 0x8100000000000081ULL
+
+/*
+ * Squares of empty that lie in a quadrant with an odd number of empties.
+ */
+static inline uint64_t oddRegions(uint64_t empty) {
+    uint64_t odd = 0;
+    for (int q = 0; q < 4; q++) {
+        if (__builtin_popcountll(empty & QUADRANTS[q]) & 1) {
+            odd |= QUADRANTS[q];
+        }
+    }
+    return odd;
+}
+
+/*
+ * Hash key for a position with P to move. Swapping P and O gives the
+ * other side to move, so no separate side key is needed.
+ */
+static inline uint64_t positionKey(uint64_t P, uint64_t O) {
+    uint64_t h = P * 0x9e3779b97f4a7c15ULL;
+    h ^= (O ^ (h >> 32)) * 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 29);
+}
+
+/*
+ * Creates a solver with a hash table of the given size.
+ */
+EndgameSolver::EndgameSolver(size_t megabytes)
+    : _table(megabytes), _stop(NULL), _hasDeadline(false), _aborted(false),
+      _nextPoll(POLLNODES), nodes(0) {
+}
+
+/*
+ * Makes searches give up once the given time has passed.
+ */
+void EndgameSolver::setDeadline(chrono::steady_clock::time_point deadline) {
+    _deadline = deadline;
+    _hasDeadline = true;
+}
+
+/*
+ * Returns true if the search has been asked to stop or is out of time.
+ */
+bool EndgameSolver::poll() {
+    if (_stop && _stop->load(memory_order_relaxed)) return true;
+    return _hasDeadline && chrono::steady_clock::now() >= _deadline;
+}
+
+/*
+ * Solves the position with P to move. On success stores the best move and
+ * the final disc difference for P under perfect play (exact when it falls
+ * inside alpha..beta, a bound otherwise) and returns true. Returns false
+ * if P has no move or the search was interrupted.
+ */
+bool EndgameSolver::solve(uint64_t P, uint64_t O, int alpha, int beta,
+                          int &bestMove, int &score) {
+    _aborted = false;
+    _nextPoll = nodes + POLLNODES;
+    _table.newSearch();
+
+    uint64_t moves = Board::getMoves(P, O);
+    if (moves == 0) return false;
+
+    // Fastest-first at the root: fewest opponent replies first.
+    int squares[64], order[64], count = 0;
+    while (moves) {
+        int sq = __builtin_ctzll(moves);
+        moves &= moves - 1;
+        uint64_t flips = Board::getFlips(sq, P, O);
+        uint64_t nextP = P | flips | (1ULL << sq);
+        int key = __builtin_popcountll(Board::getMoves(O & ~flips, nextP));
+        int j = count++;
+        for (; j > 0 && order[j - 1] > key; j--) {
+            squares[j] = squares[j - 1];
+            order[j] = order[j - 1];
+        }
+        squares[j] = sq;
+        order[j] = key;
+    }
+
+    int best = -SOLVEINF;
+    bestMove = squares[0];
+    for (int k = 0; k < count; k++) {
+        int sq = squares[k];
+        uint64_t flips = Board::getFlips(sq, P, O);
+        uint64_t nextP = P | flips | (1ULL << sq);
+        uint64_t nextO = O & ~flips;
+        int value;
+        if (k == 0) {
+            value = -search(nextO, nextP, -beta, -alpha, false);
+        } else {
+            value = -search(nextO, nextP, -alpha - 1, -alpha, false);
+            if (value > alpha && value < beta) {
+                value = -search(nextO, nextP, -beta, -alpha, false);
+            }
+        }
+        if (_aborted) return false;
+
+        if (value > best) {
+            best = value;
+            bestMove = sq;
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) break;
+        }
+    }
+    score = best;
+    return true;
+}
+
+/*
+ * Negamax search to the end of the game with P to move. passed is set
+ * when the opponent has just passed, so a second pass ends the game.
+ */
+int EndgameSolver::search(uint64_t P, uint64_t O, int alpha, int beta, bool passed) {
+    if (++nodes >= _nextPoll) {
+        _nextPoll = nodes + POLLNODES;
+        if (poll()) {
+            _aborted = true;
+        }
+    }
+    if (_aborted) return 0;
+
+    uint64_t empty = ~(P | O);
+    int n = __builtin_popcountll(empty);
+
+    // Last few empties: walk the empty squares directly, odd regions first.
+    if (n <= 4) {
+        int empties[4], k = 0;
+        uint64_t odd = empty & oddRegions(empty);
+        for (uint64_t e = odd; e; e &= e - 1) empties[k++] = __builtin_ctzll(e);
+        for (uint64_t e = empty & ~odd; e; e &= e - 1) empties[k++] = __builtin_ctzll(e);
+        return searchShallow(P, O, alpha, beta, empties, n, passed);
+    }
+
+    // Stability cutoff: the opponent's stable discs cap our final score.
+    // Only worth computing when alpha is high enough for it to bite.
+    if (alpha >= STABILITYALPHA * n) {
+        int bound = 64 - 2 * __builtin_popcountll(Board::getStable(O, P));
+        if (bound <= alpha) {
+            return bound;
+        }
+    }
+
+    uint64_t moves = Board::getMoves(P, O);
+    if (moves == 0) {
+        if (passed) {
+            return __builtin_popcountll(P) - __builtin_popcountll(O);
+        }
+        return -search(O, P, -beta, -alpha, true);
+    }
+
+    uint64_t key = 0;
+    int hashMove = NOMOVE;
+    int origAlpha = alpha;
+    if (n >= HASHEMPTIES) {
+        key = positionKey(P, O);
+        TTEntry entry;
+        if (_table.probe(key, entry)) {
+            if (entry.bound == BOUND_EXACT ||
+                (entry.bound == BOUND_LOWER && entry.score >= beta) ||
+                (entry.bound == BOUND_UPPER && entry.score <= alpha)) {
+                return entry.score;
+            }
+            hashMove = entry.move;
+        }
+    }
+
+    // Order the moves: hash move, then fewest opponent replies (with
+    // corners first) far from the end, or odd regions first close to it.
+    int squares[64], order[64], count = 0;
+    uint64_t odd = oddRegions(empty);
+    while (moves) {
+        int sq = __builtin_ctzll(moves);
+        moves &= moves - 1;
+        uint64_t bit = 1ULL << sq;
+        int key;
+        if (sq == hashMove) {
+            key = -1000;
+        } else if (n >= FASTESTEMPTIES) {
+            uint64_t flips = Board::getFlips(sq, P, O);
+            key = 4 * __builtin_popcountll(Board::getMoves(O & ~flips, P | flips | bit));
+            if (bit & CORNERSQUARES) key -= 8;
+            if (bit & odd) key -= 1;
+        } else {
+            key = (bit & odd) ? 0 : 1;
+        }
+        int j = count++;
+        for (; j > 0 && order[j - 1] > key; j--) {
+            squares[j] = squares[j - 1];
+            order[j] = order[j - 1];
+        }
+        squares[j] = sq;
+        order[j] = key;
+    }
+
+    int best = -SOLVEINF;
+    int bestMove = NOMOVE;
+    for (int k = 0; k < count; k++) {
+        int sq = squares[k];
+        uint64_t flips = Board::getFlips(sq, P, O);
+        uint64_t nextP = P | flips | (1ULL << sq);
+        uint64_t nextO = O & ~flips;
+        int value;
+        if (k == 0) {
+            value = -search(nextO, nextP, -beta, -alpha, false);
+        } else {
+            value = -search(nextO, nextP, -alpha - 1, -alpha, false);
+            if (value > alpha && value < beta) {
+                value = -search(nextO, nextP, -beta, -alpha, false);
+            }
+        }
+        if (value > best) {
+            best = value;
+            bestMove = sq;
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) break;
+        }
+    }
+
+    if (n >= HASHEMPTIES && !_aborted) {
+        int bound = BOUND_EXACT;
+        if (best <= origAlpha) {
+            bound = BOUND_UPPER;
+        } else if (best >= beta) {
+            bound = BOUND_LOWER;
+        }
+        _table.store(key, n, bound, best, bestMove);
+    }
+    return best;
+}
+
+/*
+ * Search for the last four or fewer empties, given as a list in the
+ * order to try them. Avoids generating move masks and hashing; every
+ * empty square is simply tried in turn.
+ */
+int EndgameSolver::searchShallow(uint64_t P, uint64_t O, int alpha, int beta,
+                                 int *empties, int n, bool passed) {
+    nodes++;
+    if (n == 1) {
+        return lastMove(P, O, empties[0]);
+    }
+
+    int best = -SOLVEINF;
+    bool moved = false;
+    for (int k = 0; k < n; k++) {
+        int sq = empties[k];
+        uint64_t flips = Board::getFlips(sq, P, O);
+        if (flips == 0) continue;
+        moved = true;
+
+        int rest[3];
+        for (int j = 0, r = 0; j < n; j++) {
+            if (j != k) rest[r++] = empties[j];
+        }
+        int value = -searchShallow(O & ~flips, P | flips | (1ULL << sq),
+                                   -beta, -alpha, rest, n - 1, false);
+        if (value > best) {
+            best = value;
+            if (value > alpha) alpha = value;
+            if (alpha >= beta) break;
+        }
+    }
+
+    if (!moved) {
+        if (passed) {
+            return __builtin_popcountll(P) - __builtin_popcountll(O);
+        }
+        return -searchShallow(O, P, -beta, -alpha, empties, n, true);
+    }
+    return best;
+}
+
+/*
+ * Final disc difference for P with one empty square left. Only counts the
+ * discs the last move would flip; the board itself is never updated.
+ */
+int EndgameSolver::lastMove(uint64_t P, uint64_t O, int square) {
+    nodes++;
+    int p = __builtin_popcountll(P);
+    int flipped = __builtin_popcountll(Board::getFlips(square, P, O));
+    if (flipped) {
+        return 2 * p + 2 * flipped - 62;
+    }
+    flipped = __builtin_popcountll(Board::getFlips(square, O, P));
+    if (flipped) {
+        return 2 * p - 2 * flipped - 64;
+    }
+    return 2 * p - 63;
+}
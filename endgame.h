@@ -0,0 +1,62 @@
+#ifndef __ENDGAME_H__
+#define __ENDGAME_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "transposition.h"
+
+// Empties at which the player switches from the heuristic search to the
+// exact solver.
+#define ENDGAMEEMPTIES 20
+#define ENDGAMEHASHMB 16
+
+// Below these many empties the solver stops using the hash table and
+// fastest-first ordering, which cost more than they save that close to
+// the end, and orders by parity only.
+#define HASHEMPTIES 8
+#define FASTESTEMPTIES 6
+
+// Nodes between two checks of the stop flag and the deadline.
+#define POLLNODES 4096
+
+/*
+ * Exact endgame solver. Works directly on (player, opponent) bitboards
+ * and returns final disc differences, so it plays perfectly once it
+ * completes. Searches can be interrupted through a stop flag or a
+ * deadline, in which case solve() reports failure.
+ */
+class EndgameSolver {
+
+private:
+    TranspositionTable _table;
+    std::atomic<bool> *_stop;
+    std::chrono::steady_clock::time_point _deadline;
+    bool _hasDeadline;
+    bool _aborted;
+    // Node count at which search() next polls; every path counts nodes,
+    // so a multiple of POLLNODES could be stepped over.
+    uint64_t _nextPoll;
+
+    bool poll();
+    int search(uint64_t P, uint64_t O, int alpha, int beta, bool passed);
+    int searchShallow(uint64_t P, uint64_t O, int alpha, int beta,
+                      int *empties, int n, bool passed);
+    int lastMove(uint64_t P, uint64_t O, int square);
+
+public:
+    EndgameSolver(size_t megabytes);
+
+    // Nodes visited since the counter was last reset.
+    uint64_t nodes;
+
+    void setStop(std::atomic<bool> *stop) { _stop = stop; }
+    void setDeadline(std::chrono::steady_clock::time_point deadline);
+    void clearDeadline() { _hasDeadline = false; }
+    void clear() { _table.clear(); }
+
+    bool solve(uint64_t P, uint64_t O, int alpha, int beta,
+               int &bestMove, int &score);
+};
+
+#endif
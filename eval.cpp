@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "eval.h"
+#include "board.h"
+
+using namespace std;
+
+/*
+ * Base-3 value of the binary number n: each set bit i becomes the digit 1
+ * at position i. Two of these, for our discs and twice for the
+ * opponent's, add up to a pattern index.
+ */
+static constexpr int ternary(int n) {
+    return n ? (n & 1) + 3 * ternary(n >> 1) : 0;
+}
+
+#define T1(n) ternary(n)
+#define T4(n) T1(n), T1(n + 1), T1(n + 2), T1(n + 3)
+#define T16(n) T4(n), T4(n + 4), T4(n + 8), T4(n + 12)
+#define T64(n) T16(n), T16(n + 16), T16(n + 32), T16(n + 48)
+#define T256(n) T64(n), T64(n + 64), T64(n + 128), T64(n + 192)
+
+static const int TERNARY[1024] = { T256(0), T256(256), T256(512), T256(768) };
+
+// Squares of each pattern in the board's identity orientation, in the
+// order the pattern index reads them.
+static const int PATTERNSIZE[PATTERNS] = { 10, 9, 10, 8, 8, 8, 8, 7, 6, 5, 4 };
+static const uint8_t PATTERNSQUARES[PATTERNS][10] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 9, 14 },
+    { 0, 1, 2, 8, 9, 10, 16, 17, 18 },
+    { 0, 1, 2, 3, 4, 8, 9, 10, 11, 12 },
+    { 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 16, 17, 18, 19, 20, 21, 22, 23 },
+    { 24, 25, 26, 27, 28, 29, 30, 31 },
+    { 0, 9, 18, 27, 36, 45, 54, 63 },
+    { 1, 10, 19, 28, 37, 46, 55 },
+    { 2, 11, 20, 29, 38, 47 },
+    { 3, 12, 21, 30, 39 },
+    { 4, 13, 22, 31 }
+};
+static const int PATTERNOFFSET[PATTERNS] = {
+    0, 59049, 78732, 137781, 144342, 150903, 157464, 164025, 166212,
+    166941, 167184
+};
+
+// Starting value of a disc on each square for its owner, in hundredths
+// of a disc, used when there is no weights file.
+static const int SQUAREVALUE[64] = {
+     800, -150,  100,   50,   50,  100, -150,  800,
+    -150, -250,  -20,  -20,  -20,  -20, -250, -150,
+     100,  -20,   10,    5,    5,   10,  -20,  100,
+      50,  -20,    5,    0,    0,    5,  -20,   50,
+      50,  -20,    5,    0,    0,    5,  -20,   50,
+     100,  -20,   10,    5,    5,   10,  -20,  100,
+    -150, -250,  -20,  -20,  -20,  -20, -250, -150,
+     800, -150,  100,   50,   50,  100, -150,  800
+};
+#define DEFAULTMOBILITY 50
+
+/*
+ * Gathers a pattern's squares from one image of the board into the low
+ * bits of a word, in PATTERNSQUARES order.
+ */
+static inline int edgeBits(uint64_t b) {
+    return (b & 0xff) | ((b >> 1) & 0x100) | ((b >> 5) & 0x200);
+}
+
+static inline int corner33Bits(uint64_t b) {
+    return (b & 0x7) | ((b >> 5) & 0x38) | ((b >> 10) & 0x1c0);
+}
+
+static inline int corner25Bits(uint64_t b) {
+    return (b & 0x1f) | ((b >> 3) & 0x3e0);
+}
+
+static inline int rowBits(uint64_t b, int row) {
+    return (b >> (8 * row)) & 0xff;
+}
+
+// The diagonal of length L runs up and to the right from square 8 - L.
+// Multiplying stacks its squares into the top byte without carries.
+static const uint64_t DIAGMASK[9] = {
+    0, 0, 0, 0, 0x80402010ULL, 0x8040201008ULL, 0x804020100804ULL,
+    0x80402010080402ULL, 0x8040201008040201ULL
+};
+
+static inline int diagBits(uint64_t b, int length) {
+    return ((b & DIAGMASK[length]) * 0x0101010101010101ULL) >> (64 - length);
+}
+
+/*
+ * The eight images of a bitboard under the board's symmetries, numbered
+ * as in OpeningBook::transform: bit 0 flips vertically, bit 1 mirrors and
+ * bit 2 flips along the diagonal.
+ */
+static inline void images(uint64_t b, uint64_t *image) {
+    image[0] = b;
+    image[1] = Board::flipVertical(b);
+    image[2] = Board::mirrorHorizontal(b);
+    image[3] = Board::mirrorHorizontal(image[1]);
+    for (int t = 0; t < 4; t++) {
+        image[4 + t] = Board::flipDiagonal(image[t]);
+    }
+}
+
+/*
+ * Undoes images(): maps a square of image t back onto the board.
+ */
+static inline uint64_t unimage(uint64_t b, int t) {
+    if (t & 4) b = Board::flipDiagonal(b);
+    if (t & 2) b = Board::mirrorHorizontal(b);
+    if (t & 1) b = Board::flipVertical(b);
+    return b;
+}
+
+// Pattern and image of every instance, in the order extract() reads them.
+static const int INSTANCEPATTERN[EVALINSTANCES] = {
+    PATTERNEDGE, PATTERNLINE2, PATTERNLINE3, PATTERNLINE4,
+    PATTERNEDGE, PATTERNLINE2, PATTERNLINE3, PATTERNLINE4,
+    PATTERNEDGE, PATTERNLINE2, PATTERNLINE3, PATTERNLINE4,
+    PATTERNEDGE, PATTERNLINE2, PATTERNLINE3, PATTERNLINE4,
+    PATTERNDIAG7, PATTERNDIAG6, PATTERNDIAG5, PATTERNDIAG4,
+    PATTERNDIAG7, PATTERNDIAG6, PATTERNDIAG5, PATTERNDIAG4,
+    PATTERNDIAG7, PATTERNDIAG6, PATTERNDIAG5, PATTERNDIAG4,
+    PATTERNDIAG7, PATTERNDIAG6, PATTERNDIAG5, PATTERNDIAG4,
+    PATTERNCORNER33, PATTERNCORNER33, PATTERNCORNER33, PATTERNCORNER33,
+    PATTERNCORNER25, PATTERNCORNER25, PATTERNCORNER25, PATTERNCORNER25,
+    PATTERNCORNER25, PATTERNCORNER25, PATTERNCORNER25, PATTERNCORNER25,
+    PATTERNDIAG8, PATTERNDIAG8
+};
+static const int INSTANCEIMAGE[EVALINSTANCES] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 4, 4, 4, 4, 6, 6, 6, 6,
+    0, 0, 0, 0, 1, 1, 1, 1, 4, 4, 4, 4, 5, 5, 5, 5,
+    0, 1, 2, 3,
+    0, 1, 2, 3, 4, 5, 6, 7,
+    0, 1
+};
+
+/*
+ * Fills in the instances of every square.
+ */
+SquareInstances::SquareInstances() {
+    for (int sq = 0; sq < 64; sq++) {
+        count[sq] = 0;
+    }
+    for (int i = 0; i < EVALINSTANCES; i++) {
+        int p = INSTANCEPATTERN[i];
+        for (int j = 0, power = 1; j < PATTERNSIZE[p]; j++, power *= 3) {
+            int sq = __builtin_ctzll(unimage(1ULL << PATTERNSQUARES[p][j],
+                                             INSTANCEIMAGE[i]));
+            instance[sq][count[sq]] = i;
+            this->power[sq][count[sq]] = power;
+            count[sq]++;
+        }
+    }
+}
+
+const SquareInstances SQUAREINSTANCES;
+
+/*
+ * Creates an evaluator with the default weights.
+ */
+Evaluator::Evaluator() : _weights(EVALPHASES * EVALWEIGHTS) {
+    setDefault();
+}
+
+/*
+ * Fills in weights equivalent to a table of square values plus mobility,
+ * the same in every phase. A square seen by several pattern instances
+ * shares its value between them.
+ */
+void Evaluator::setDefault() {
+    int coverage[64];
+    int indices[EVALINSTANCES];
+    for (int sq = 0; sq < 64; sq++) {
+        extract(1ULL << sq, 0, indices);
+        coverage[sq] = 0;
+        for (int i = 0; i < EVALINSTANCES; i++) {
+            for (int p = PATTERNS - 1; p >= 0; p--) {
+                if (indices[i] >= PATTERNOFFSET[p]) {
+                    coverage[sq] += (indices[i] != PATTERNOFFSET[p]);
+                    break;
+                }
+            }
+        }
+    }
+
+    int16_t *w = weights(0);
+    for (int p = 0; p < PATTERNS; p++) {
+        int size = 1;
+        for (int i = 0; i < PATTERNSIZE[p]; i++) size *= 3;
+        for (int index = 0; index < size; index++) {
+            double value = 0;
+            for (int i = 0, n = index; i < PATTERNSIZE[p]; i++, n /= 3) {
+                int sq = PATTERNSQUARES[p][i];
+                if (n % 3 == 1) value += (double) SQUAREVALUE[sq] / coverage[sq];
+                if (n % 3 == 2) value -= (double) SQUAREVALUE[sq] / coverage[sq];
+            }
+            w[PATTERNOFFSET[p] + index] = (int16_t) lround(value);
+        }
+    }
+    w[MOBILITYWEIGHT] = DEFAULTMOBILITY;
+    w[BIASWEIGHT] = 0;
+    for (int phase = 1; phase < EVALPHASES; phase++) {
+        copy(w, w + EVALWEIGHTS, weights(phase));
+    }
+}
+
+/*
+ * Loads weights written by save(). Returns false, keeping the current
+ * weights, if the file is missing or does not match this layout.
+ */
+bool Evaluator::load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    EvalHeader header;
+    vector<int16_t> weights(EVALPHASES * EVALWEIGHTS);
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              header.magic == EVALMAGIC && header.phases == EVALPHASES &&
+              header.weights == EVALWEIGHTS &&
+              fread(&weights[0], sizeof(int16_t), weights.size(), f) == weights.size();
+    fclose(f);
+    if (ok) {
+        _weights.swap(weights);
+    }
+    return ok;
+}
+
+/*
+ * Writes the weights as a header followed by every phase's weights.
+ */
+bool Evaluator::save(const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    EvalHeader header;
+    header.magic = EVALMAGIC;
+    header.phases = EVALPHASES;
+    header.weights = EVALWEIGHTS;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(&_weights[0], sizeof(int16_t), _weights.size(), f) == _weights.size();
+    return (fclose(f) == 0) && ok;
+}
+
+/*
+ * Our number of moves less the opponent's.
+ */
+int Evaluator::mobility(uint64_t P, uint64_t O) {
+    uint64_t movesP, movesO;
+    Board::getMoves(P, O, movesP, movesO);
+    return __builtin_popcountll(movesP) - __builtin_popcountll(movesO);
+}
+
+/*
+ * Computes the index into a phase's weights of every pattern instance on
+ * the board, with P the side to move. Edges and lines are read on all
+ * four sides, the corner blocks at every corner (the 2x5 block both
+ * ways round) and the diagonals in both directions.
+ */
+void Evaluator::extract(uint64_t P, uint64_t O, int *indices) {
+    uint64_t p[8], o[8];
+    images(P, p);
+    images(O, o);
+    int n = 0;
+
+    // Images that bring each side of the board to the bottom row, and
+    // each of the four short diagonals next to the long ones to the same
+    // place.
+    static const int SIDES[4] = { 0, 1, 4, 6 };
+    static const int DIAGONALS[4] = { 0, 1, 4, 5 };
+    for (int k = 0; k < 4; k++) {
+        int t = SIDES[k];
+        indices[n++] = PATTERNOFFSET[PATTERNEDGE]
+                     + TERNARY[edgeBits(p[t])] + 2 * TERNARY[edgeBits(o[t])];
+        for (int row = 1; row <= 3; row++) {
+            indices[n++] = PATTERNOFFSET[PATTERNLINE2 + row - 1]
+                         + TERNARY[rowBits(p[t], row)] + 2 * TERNARY[rowBits(o[t], row)];
+        }
+    }
+    for (int k = 0; k < 4; k++) {
+        int t = DIAGONALS[k];
+        for (int length = 7; length >= 4; length--) {
+            indices[n++] = PATTERNOFFSET[PATTERNDIAG7 + 7 - length]
+                         + TERNARY[diagBits(p[t], length)]
+                         + 2 * TERNARY[diagBits(o[t], length)];
+        }
+    }
+    for (int t = 0; t < 4; t++) {
+        indices[n++] = PATTERNOFFSET[PATTERNCORNER33]
+                     + TERNARY[corner33Bits(p[t])] + 2 * TERNARY[corner33Bits(o[t])];
+    }
+    for (int t = 0; t < 8; t++) {
+        indices[n++] = PATTERNOFFSET[PATTERNCORNER25]
+                     + TERNARY[corner25Bits(p[t])] + 2 * TERNARY[corner25Bits(o[t])];
+    }
+    for (int t = 0; t < 2; t++) {
+        indices[n++] = PATTERNOFFSET[PATTERNDIAG8]
+                     + TERNARY[diagBits(p[t], 8)] + 2 * TERNARY[diagBits(o[t], 8)];
+    }
+}
+
+/*
+ * Evaluates the position for P, the side to move.
+ */
+int Evaluator::evaluate(uint64_t P, uint64_t O) {
+    int indices[EVALINSTANCES];
+    extract(P, O, indices);
+    const int16_t *w = weights(phase(P, O));
+
+    int score = w[BIASWEIGHT] + w[MOBILITYWEIGHT] * mobility(P, O);
+    for (int i = 0; i < EVALINSTANCES; i++) {
+        score += w[indices[i]];
+    }
+    return max(-EVALMAX + 1, min(score, EVALMAX - 1));
+}
+
+/*
+ * Computes the state of a position from scratch.
+ */
+void Evaluator::initState(EvalState &state, uint64_t black, uint64_t white) {
+    extract(black, white, state.indices[BLACK]);
+    extract(white, black, state.indices[WHITE]);
+}
+
+int Evaluator::patternSize(int pattern) {
+    return PATTERNSIZE[pattern];
+}
+
+const uint8_t *Evaluator::patternSquares(int pattern) {
+    return PATTERNSQUARES[pattern];
+}
+
+int Evaluator::patternOffset(int pattern) {
+    return PATTERNOFFSET[pattern];
+}
@@ -0,0 +1,182 @@
+#ifndef __EVAL_H__
+#define __EVAL_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "common.h"
+
+#define EVALFILE "eval.weights"
+#define EVALMAGIC 0x31564550U
+
+// Evaluations are in hundredths of a disc and never reach EVALMAX, which
+// keeps them clear of the search's win/loss scores.
+#define EVALSCALE 100
+#define EVALMAX 60000
+
+// Weight sets, each used for an equal slice of the game by disc count.
+#define EVALPHASES 6
+
+// Pattern kinds, and the number of pattern instances read from a board.
+#define PATTERNEDGE 0
+#define PATTERNCORNER33 1
+#define PATTERNCORNER25 2
+#define PATTERNLINE2 3
+#define PATTERNLINE3 4
+#define PATTERNLINE4 5
+#define PATTERNDIAG8 6
+#define PATTERNDIAG7 7
+#define PATTERNDIAG6 8
+#define PATTERNDIAG5 9
+#define PATTERNDIAG4 10
+#define PATTERNS 11
+#define EVALINSTANCES 46
+
+// Layout of one phase's weights: every pattern's table of 3^size entries,
+// then the mobility and constant terms.
+#define PATTERNWEIGHTS 167265
+#define MOBILITYWEIGHT PATTERNWEIGHTS
+#define BIASWEIGHT (PATTERNWEIGHTS + 1)
+#define EVALWEIGHTS (PATTERNWEIGHTS + 2)
+
+struct EvalHeader {
+    uint32_t magic;
+    uint32_t phases;
+    uint32_t weights;
+};
+
+/*
+ * Pattern indices of a position as seen by each side, kept up to date
+ * move by move during a search so that evaluating a leaf only has to add
+ * up weights.
+ */
+struct EvalState {
+    int indices[2][EVALINSTANCES];
+};
+
+// The most pattern instances any one square belongs to.
+#define MAXSQUAREINSTANCES 8
+
+/*
+ * For every square, the instances that read it and the power of three
+ * its digit has in each of them.
+ */
+struct SquareInstances {
+    int count[64];
+    int instance[64][MAXSQUAREINSTANCES];
+    int power[64][MAXSQUAREINSTANCES];
+
+    SquareInstances();
+};
+
+extern const SquareInstances SQUAREINSTANCES;
+
+/*
+ * Pattern-based evaluation. The board is read through fixed groups of
+ * squares (the edges with their X squares, the corner 3x3 and 2x5
+ * blocks, the inner lines and the diagonals) in each of the orientations
+ * the board's symmetries give them. Each group's contents, as a base-3
+ * number with 0 empty, 1 the side to move and 2 the opponent, indexes a
+ * weight table for the current phase; the evaluation is the sum of those
+ * weights plus a mobility term.
+ */
+class Evaluator {
+
+private:
+    std::vector<int16_t> _weights;
+
+public:
+    Evaluator();
+
+    void setDefault();
+    bool load(const char *path);
+    bool save(const char *path);
+
+    int evaluate(uint64_t P, uint64_t O);
+    template <Side S> int evaluate(const EvalState &state, uint64_t P, uint64_t O);
+
+    static void initState(EvalState &state, uint64_t black, uint64_t white);
+    template <Side S> static void update(EvalState &state, int square, uint64_t flips);
+    template <Side S> static void restore(EvalState &state, int square, uint64_t flips);
+
+    int16_t *weights(int phase) { return &_weights[phase * EVALWEIGHTS]; }
+
+    // Phase a position falls in, from its number of discs.
+    static int phase(uint64_t P, uint64_t O) {
+        return (__builtin_popcountll(P | O) - 4) * EVALPHASES / 61;
+    }
+    static int mobility(uint64_t P, uint64_t O);
+    static void extract(uint64_t P, uint64_t O, int *indices);
+    static int patternSize(int pattern);
+    static const uint8_t *patternSquares(int pattern);
+    static int patternOffset(int pattern);
+};
+
+/*
+ * Evaluates the position for side S from an up to date state; P and O
+ * are S's discs and the opponent's, for the phase and mobility. Inline,
+ * like update() and restore(), so that the search's leaves and moves
+ * compile down to the pattern sums.
+ */
+template <Side S>
+inline int Evaluator::evaluate(const EvalState &state, uint64_t P, uint64_t O) {
+    const int *indices = state.indices[S];
+    const int16_t *w = weights(phase(P, O));
+
+    int score = w[BIASWEIGHT] + w[MOBILITYWEIGHT] * mobility(P, O);
+    for (int i = 0; i < EVALINSTANCES; i++) {
+        score += w[indices[i]];
+    }
+    return std::max(-EVALMAX + 1, std::min(score, EVALMAX - 1));
+}
+
+/*
+ * Brings the state up to date with a move by side S on square that
+ * flipped the given discs. For the mover a new disc adds the digit 1 and
+ * a flipped one turns 2 into 1; for the opponent it is the other way
+ * round.
+ */
+template <Side S>
+inline void Evaluator::update(EvalState &state, int square, uint64_t flips) {
+    int *own = state.indices[S];
+    int *opp = state.indices[otherSide(S)];
+    const SquareInstances &t = SQUAREINSTANCES;
+
+    for (int k = 0; k < t.count[square]; k++) {
+        own[t.instance[square][k]] += t.power[square][k];
+        opp[t.instance[square][k]] += 2 * t.power[square][k];
+    }
+    while (flips) {
+        int sq = __builtin_ctzll(flips);
+        flips &= flips - 1;
+        for (int k = 0; k < t.count[sq]; k++) {
+            own[t.instance[sq][k]] -= t.power[sq][k];
+            opp[t.instance[sq][k]] += t.power[sq][k];
+        }
+    }
+}
+
+/*
+ * Takes back a move applied with update().
+ */
+template <Side S>
+inline void Evaluator::restore(EvalState &state, int square, uint64_t flips) {
+    int *own = state.indices[S];
+    int *opp = state.indices[otherSide(S)];
+    const SquareInstances &t = SQUAREINSTANCES;
+
+    for (int k = 0; k < t.count[square]; k++) {
+        own[t.instance[square][k]] -= t.power[square][k];
+        opp[t.instance[square][k]] -= 2 * t.power[square][k];
+    }
+    while (flips) {
+        int sq = __builtin_ctzll(flips);
+        flips &= flips - 1;
+        for (int k = 0; k < t.count[sq]; k++) {
+            own[t.instance[sq][k]] += t.power[sq][k];
+            opp[t.instance[sq][k]] -= t.power[sq][k];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,314 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gamerecord.h"
+
+using namespace std;
+
+static inline size_t recordSize(const GameHeader &h) {
+    return sizeof(GameHeader) + ((h.flags & GAMESTART) ? 2 * sizeof(uint64_t) : 0) + h.moves;
+}
+
+/*
+ * Checksum of a whole record, leaving out its check byte.
+ */
+static uint8_t checksum(const uint8_t *record, size_t size) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (i != offsetof(GameHeader, check)) {
+            sum = sum * 31 + record[i];
+        }
+    }
+    return (uint8_t) (sum ^ (sum >> 8) ^ (sum >> 16) ^ (sum >> 24));
+}
+
+/*
+ * Writes all of data, however many calls it takes.
+ */
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+ * Creates a reader with no file open.
+ */
+GameReader::GameReader() : _map(NULL), _mapSize(0), _offset(0), _damaged(false) {
+}
+
+GameReader::~GameReader() {
+    close();
+}
+
+/*
+ * Maps the game file at path. The file is mapped as it is when opened,
+ * under a shared lock so that no record is half written; games appended
+ * later are not seen. Returns false if the file is missing or is not a
+ * game file.
+ */
+bool GameReader::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        close();
+        return false;
+    }
+    flock(fd, LOCK_SH);
+    bool ok = this->open(fd);
+    ::close(fd);
+    return ok;
+}
+
+/*
+ * Maps the file open as fd, which the caller has locked and still owns.
+ */
+bool GameReader::open(int fd) {
+    close();
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(GameFileHeader)) {
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    if (((const GameFileHeader *) map)->magic != GAMEMAGIC) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    _map = map;
+    _mapSize = st.st_size;
+    this->rewind();
+    return true;
+}
+
+/*
+ * Unmaps the file. Records read from it are no longer valid.
+ */
+void GameReader::close() {
+    if (_map) {
+        munmap(_map, _mapSize);
+    }
+    _map = NULL;
+    _mapSize = 0;
+    _offset = 0;
+    _damaged = false;
+}
+
+/*
+ * Reads the next game into game and returns true, or returns false at
+ * the end of the file or at a damaged record.
+ */
+bool GameReader::next(GameRecord &game) {
+    if (!_map || _damaged || _offset == _mapSize) {
+        return false;
+    }
+    const uint8_t *record = (const uint8_t *) _map + _offset;
+    GameHeader h;
+    if (_mapSize - _offset < sizeof(GameHeader)) {
+        _damaged = true;
+        return false;
+    }
+    memcpy(&h, record, sizeof(h));
+    size_t size = recordSize(h);
+    if ((h.flags & ~(GAMESTART | GAMEWHITEFIRST | GAMEFORFEIT)) || size > _mapSize - _offset ||
+            checksum(record, size) != h.check) {
+        _damaged = true;
+        return false;
+    }
+    const uint8_t *moves = record + size - h.moves;
+    for (int i = 0; i < h.moves; i++) {
+        if (moves[i] >= 64) {
+            _damaged = true;
+            return false;
+        }
+    }
+
+    game.black = h.black;
+    game.white = h.white;
+    game.result = h.result;
+    game.forfeit = (h.flags & GAMEFORFEIT) != 0;
+    game.standardStart = !(h.flags & GAMESTART);
+    if (h.flags & GAMESTART) {
+        memcpy(&game.startBlack, record + sizeof(GameHeader), sizeof(uint64_t));
+        memcpy(&game.startWhite, record + sizeof(GameHeader) + sizeof(uint64_t),
+               sizeof(uint64_t));
+    } else {
+        Board start;
+        game.startBlack = start.own<BLACK>();
+        game.startWhite = start.own<WHITE>();
+    }
+    game.firstSide = (h.flags & GAMEWHITEFIRST) ? WHITE : BLACK;
+    game.moves = moves;
+    game.count = h.moves;
+    _offset += size;
+    return true;
+}
+
+/*
+ * Creates a writer with no file open.
+ */
+GameRecordWriter::GameRecordWriter() : _fd(-1) {
+}
+
+GameRecordWriter::~GameRecordWriter() {
+    close();
+}
+
+/*
+ * Opens path for appending, creating it if needed. A torn record at the
+ * end of the file is cut off first. Returns false if the file cannot be
+ * opened or is not a game file.
+ */
+bool GameRecordWriter::open(const char *path) {
+    close();
+    int fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    flock(fd, LOCK_EX);
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0) {
+        GameFileHeader header;
+        header.magic = GAMEMAGIC;
+        header.unused = 0;
+        ok = writeAll(fd, (const char *) &header, sizeof(header));
+    } else if (ok) {
+        // The lock keeps other writers out, so a bad record can only have
+        // been left by one that died.
+        GameReader reader;
+        ok = reader.open(fd);
+        GameRecord game;
+        while (ok && reader.next(game)) {
+        }
+        if (ok && reader.damaged()) {
+            ok = ftruncate(fd, reader.offset()) == 0;
+        }
+    }
+    flock(fd, LOCK_UN);
+    if (!ok) {
+        ::close(fd);
+        return false;
+    }
+    _fd = fd;
+    return true;
+}
+
+/*
+ * Writes out the games still in memory and closes the file. Returns
+ * false if they could not be written.
+ */
+bool GameRecordWriter::close() {
+    bool ok = this->flush();
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+    return ok;
+}
+
+/*
+ * Adds a game. It reaches the file once GAMEBUFFER bytes of games have
+ * been collected, or at the next flush() or close(). Returns false if
+ * the game cannot be stored or the write failed.
+ */
+bool GameRecordWriter::append(const GameRecord &game) {
+    if (game.count < 0 || game.count > 255) {
+        return false;
+    }
+    GameHeader h;
+    h.moves = game.count;
+    h.flags = (game.standardStart ? 0 : GAMESTART) | (game.firstSide == WHITE ? GAMEWHITEFIRST : 0)
+            | (game.forfeit ? GAMEFORFEIT : 0);
+    h.result = game.result;
+    h.check = 0;
+    h.black = game.black;
+    h.white = game.white;
+
+    string record((const char *) &h, sizeof(h));
+    if (!game.standardStart) {
+        record.append((const char *) &game.startBlack, sizeof(uint64_t));
+        record.append((const char *) &game.startWhite, sizeof(uint64_t));
+    }
+    record.append((const char *) game.moves, game.count);
+    record[offsetof(GameHeader, check)] = checksum((const uint8_t *) record.data(), record.size());
+
+    lock_guard<mutex> guard(_lock);
+    _buffer += record;
+    return _buffer.size() < GAMEBUFFER || this->writeBuffer();
+}
+
+/*
+ * Writes out the games still in memory.
+ */
+bool GameRecordWriter::flush() {
+    lock_guard<mutex> guard(_lock);
+    return this->writeBuffer();
+}
+
+/*
+ * Appends the buffer to the file under an exclusive lock and empties it.
+ * The caller holds _lock.
+ */
+bool GameRecordWriter::writeBuffer() {
+    if (_buffer.empty()) {
+        return true;
+    }
+    if (_fd < 0) {
+        return false;
+    }
+    flock(_fd, LOCK_EX);
+    bool ok = writeAll(_fd, _buffer.data(), _buffer.size());
+    flock(_fd, LOCK_UN);
+    _buffer.clear();
+    return ok;
+}
+
+/*
+ * Starts replaying game from its first position.
+ */
+GameReplay::GameReplay(const GameRecord &game)
+    : _game(game), _side(game.firstSide), _ply(0), _legal(true) {
+    _board.setDiscs(game.startBlack, game.startWhite);
+    this->skipPass();
+}
+
+/*
+ * Passes for the side to move if it has no moves and the game goes on.
+ */
+void GameReplay::skipPass() {
+    if (!this->done() && _board.getPossibleMoves(_side) == 0) {
+        _side = otherSide(_side);
+    }
+}
+
+/*
+ * Plays the next move. Returns false if there is none, or if it is not
+ * legal. getFlips() does not look at the square itself, so a move onto a
+ * disc is turned down here before it can corrupt the board.
+ */
+bool GameReplay::next() {
+    if (this->done()) {
+        return false;
+    }
+    uint64_t occupied = _board.own<BLACK>() | _board.own<WHITE>();
+    if (((1ULL << this->move()) & occupied) || _board.makeMove(this->move(), _side) == 0) {
+        _legal = false;
+        return false;
+    }
+    _side = otherSide(_side);
+    _ply++;
+    this->skipPass();
+    return true;
+}
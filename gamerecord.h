@@ -0,0 +1,147 @@
+#ifndef __GAMERECORD_H__
+#define __GAMERECORD_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include "board.h"
+
+#define GAMEMAGIC 0x31474d47U
+// Bytes of records a writer collects before appending them to the file.
+#define GAMEBUFFER 65536
+
+// Header flags: the game starts from a stored position rather than the
+// standard one, in that position white moves first, and the result was
+// a forfeit (time, or an illegal move or pass) rather than the board's.
+#define GAMESTART 1
+#define GAMEWHITEFIRST 2
+#define GAMEFORFEIT 4
+
+/*
+ * A game file is a GameFileHeader followed by records, each a
+ * GameHeader, the start position (two bitboards, black then white) if
+ * flags has GAMESTART, and one byte per move with the square played.
+ * Passes are not stored; a side with no moves passes when the game is
+ * replayed. check is a checksum of the header and the bytes after it,
+ * so that a torn or damaged record is noticed. All fields are little
+ * endian.
+ */
+struct GameFileHeader {
+    uint32_t magic;
+    uint32_t unused;
+};
+
+struct GameHeader {
+    uint8_t moves;
+    uint8_t flags;
+    int8_t result;
+    uint8_t check;
+    uint16_t black;
+    uint16_t white;
+};
+
+/*
+ * One game: the players' ids, black's final disc lead and whether a
+ * forfeit decided it, where it started and the squares played. Records read from a GameReader point into the
+ * mapped file, so moves is only valid while the reader is open.
+ */
+struct GameRecord {
+    int black;
+    int white;
+    int result;
+    bool forfeit;
+    bool standardStart;
+    uint64_t startBlack;
+    uint64_t startWhite;
+    Side firstSide;
+    const uint8_t *moves;
+    int count;
+};
+
+/*
+ * Reads a game file mapped into memory, one record at a time without
+ * copying. Reading stops at the end of the file or at the first record
+ * that is cut short or fails its checksum.
+ */
+class GameReader {
+
+private:
+    void *_map;
+    size_t _mapSize;
+    size_t _offset;
+    bool _damaged;
+
+public:
+    GameReader();
+    ~GameReader();
+
+    bool open(const char *path);
+    bool open(int fd);
+    void close();
+    bool next(GameRecord &game);
+    void rewind() { _offset = sizeof(GameFileHeader); _damaged = false; }
+
+    // Whether reading stopped at a bad record, and where it starts. Any
+    // offset() taken between records can be passed back to seek().
+    bool damaged() { return _damaged; }
+    size_t offset() { return _offset; }
+    void seek(size_t offset) { _offset = offset; _damaged = false; }
+};
+
+/*
+ * Appends games to a file. Records are collected in memory and written
+ * GAMEBUFFER bytes at a time, always whole records and under an
+ * exclusive lock on the file, so any number of threads and processes can
+ * append to the same file while others read it. Opening the file cuts
+ * off a torn record left by a writer that died mid-append.
+ */
+class GameRecordWriter {
+
+private:
+    int _fd;
+    std::string _buffer;
+    std::mutex _lock;
+
+    bool writeBuffer();
+
+public:
+    GameRecordWriter();
+    ~GameRecordWriter();
+
+    bool open(const char *path);
+    bool close();
+    bool append(const GameRecord &game);
+    bool flush();
+};
+
+/*
+ * Replays a game through a Board. At every step board() is the position
+ * before move(), with side() to move and passes already made; next()
+ * plays the move. done() is true once every move has been played, or
+ * when a move turns out to be illegal, in which case legal() is false.
+ */
+class GameReplay {
+
+private:
+    const GameRecord &_game;
+    Board _board;
+    Side _side;
+    int _ply;
+    bool _legal;
+
+    void skipPass();
+
+public:
+    GameReplay(const GameRecord &game);
+
+    bool done() { return _ply >= _game.count || !_legal; }
+    bool legal() { return _legal; }
+    Board &board() { return _board; }
+    Side side() { return _side; }
+    int move() { return _game.moves[_ply]; }
+    int ply() { return _ply; }
+    bool next();
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "player.h"
+using namespace std;
+
+#define READBUFFER 4096
+// Move requests served between agings of a shared transposition table.
+#define SHAREDAGEREQUESTS 64
+
+// Hosts many games in one process. Clients talk the wrapper's protocol,
+// with every line tagged by a game id of their choosing:
+//
+//   new <id> <Black|White>          ->  <id> ok
+//   board <id> <64 chars of b/w/.>  ->  <id> ok
+//   move <id> <x> <y> <msLeft>      ->  <id> <x> <y>
+//   end <id>                        ->  <id> ok
+//   status                          ->  status games <n> queued <n>
+//
+// and errors come back as "<id> error <reason>". Every game has its own
+// single-threaded Player, made with a PlayerShared so that the opening
+// book and evaluation weights are loaded once, and optionally one shared
+// transposition table, which the server rather than the players ages.
+// Move requests are searched by a pool of threads, most urgent deadline
+// first; the time a request waited in the queue is taken off its clock,
+// and its budget shrinks while there are more requests than threads.
+// Lines come from stdin, or from any number of connections to a Unix
+// domain socket, each with its own game ids.
+//
+// Usage: gameserver [-socket path] [-threads n] [-hash MB] [-sharedhash MB]
+
+struct Game {
+    string id;
+    Player *player;
+    bool busy;
+
+    Game(const string &id, Player *player) : id(id), player(player), busy(false) {}
+    ~Game() { delete player; }
+};
+
+/*
+ * A client: where replies to its lines go, and its games by id. Replies
+ * for a connection that has closed are dropped, so a search that
+ * finishes late never writes to a reused descriptor.
+ */
+struct Connection {
+    int fd;
+    bool open;
+    mutex lock;
+    map<string, shared_ptr<Game> > games;
+
+    Connection(int fd) : fd(fd), open(true) {}
+
+    void shut() {
+        lock_guard<mutex> guard(lock);
+        open = false;
+        close(fd);
+    }
+
+    void reply(const string &line) {
+        string out = line + "\n";
+        lock_guard<mutex> guard(lock);
+        if (!open) return;
+        size_t done = 0;
+        while (done < out.size()) {
+            ssize_t n = (fd == STDOUT_FILENO)
+                ? write(fd, out.data() + done, out.size() - done)
+                : send(fd, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+            if (n <= 0) return;
+            done += n;
+        }
+    }
+};
+
+/*
+ * A move request. Requests with an earlier deadline are searched first;
+ * untimed ones wait for all the timed ones.
+ */
+struct Request {
+    shared_ptr<Connection> connection;
+    shared_ptr<Game> game;
+    int x, y, msLeft;
+    chrono::steady_clock::time_point arrival, deadline;
+    uint64_t sequence;
+
+    bool operator<(const Request &r) const {
+        if (deadline != r.deadline) return deadline > r.deadline;
+        return sequence > r.sequence;
+    }
+};
+
+static PlayerShared *shared;
+static int hashMB = SESSIONHASHMB;
+
+static mutex queueLock;
+static condition_variable queueReady;
+static priority_queue<Request> requests;
+static uint64_t sequence;
+static uint64_t served;
+static int searching;
+static int poolSize;
+static bool closing;
+static atomic<int> gameCount(0);
+
+static void worker() {
+    while (true) {
+        Request r;
+        int load;
+        {
+            unique_lock<mutex> lock(queueLock);
+            queueReady.wait(lock, [] { return closing || !requests.empty(); });
+            if (requests.empty()) return;
+            r = requests.top();
+            requests.pop();
+            load = requests.size() + ++searching;
+            // Entries from moves long since played go first once the
+            // table is full, whichever game stored them.
+            if (shared->table && ++served % SHAREDAGEREQUESTS == 0) {
+                shared->table->newSearch();
+            }
+        }
+
+        // The game's clock kept running while the request waited, and it
+        // keeps running while other games share the pool, so the player
+        // is given the time left scaled down by how oversubscribed the
+        // pool is.
+        int msLeft = r.msLeft;
+        if (msLeft > 0) {
+            int waited = chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now() - r.arrival).count();
+            msLeft = max(msLeft - waited, 1);
+            if (load > poolSize) {
+                msLeft = max((int) ((long) msLeft * poolSize / load), 1);
+            }
+        }
+        Move *opponentsMove = (r.x >= 0 && r.y >= 0) ? new Move(r.x, r.y) : NULL;
+        Move *m = r.game->player->doMove(opponentsMove, msLeft);
+        delete opponentsMove;
+
+        ostringstream out;
+        out << r.game->id << " " << (m ? m->x : -1) << " " << (m ? m->y : -1);
+        delete m;
+        {
+            lock_guard<mutex> lock(queueLock);
+            r.game->busy = false;
+            searching--;
+        }
+        r.connection->reply(out.str());
+    }
+}
+
+/*
+ * Handles one line from a client. Moves are queued for the pool; the
+ * rest is answered at once.
+ */
+static void handleLine(shared_ptr<Connection> c, const string &line) {
+    istringstream in(line);
+    string command, id;
+    in >> command;
+    if (command == "status") {
+        lock_guard<mutex> lock(queueLock);
+        ostringstream out;
+        out << "status games " << gameCount << " queued " << requests.size();
+        c->reply(out.str());
+        return;
+    }
+    if (!(in >> id)) {
+        if (!command.empty()) c->reply("error unknown command");
+        return;
+    }
+
+    map<string, shared_ptr<Game> >::iterator it = c->games.find(id);
+    if (command == "new") {
+        string side;
+        in >> side;
+        if (it != c->games.end()) {
+            c->reply(id + " error game exists");
+            return;
+        }
+        if (side != "Black" && side != "White") {
+            c->reply(id + " error bad side");
+            return;
+        }
+        Player *player = new Player(side == "Black" ? BLACK : WHITE, shared);
+        player->setThreads(1);
+        if (!shared->table) {
+            player->setHashSize(hashMB);
+        }
+        c->games[id] = make_shared<Game>(id, player);
+        gameCount++;
+        c->reply(id + " ok");
+        return;
+    }
+    if (it == c->games.end()) {
+        c->reply(id + " error no such game");
+        return;
+    }
+    shared_ptr<Game> game = it->second;
+
+    lock_guard<mutex> lock(queueLock);
+    if (command == "end") {
+        // A search still running keeps the game alive until it is done,
+        // and its reply is still sent.
+        c->games.erase(it);
+        gameCount--;
+        c->reply(id + " ok");
+    } else if (game->busy) {
+        c->reply(id + " error busy");
+    } else if (command == "board") {
+        string data;
+        if (!(in >> data) || data.size() != 64) {
+            c->reply(id + " error bad board");
+            return;
+        }
+        game->player->setBoard(&data[0]);
+        c->reply(id + " ok");
+    } else if (command == "move") {
+        Request r;
+        if (!(in >> r.x >> r.y >> r.msLeft)) {
+            c->reply(id + " error bad move");
+            return;
+        }
+        r.connection = c;
+        r.game = game;
+        r.arrival = chrono::steady_clock::now();
+        r.deadline = (r.msLeft > 0) ? r.arrival + chrono::milliseconds(r.msLeft)
+                                    : chrono::steady_clock::time_point::max();
+        r.sequence = sequence++;
+        game->busy = true;
+        requests.push(r);
+        queueReady.notify_one();
+    } else {
+        c->reply(id + " error unknown command");
+    }
+}
+
+static void closeConnection(shared_ptr<Connection> c) {
+    gameCount -= c->games.size();
+    c->games.clear();
+    c->shut();
+}
+
+/*
+ * Serves the socket until the process is killed: one poll() over the
+ * listening socket and every connection, splitting input into lines.
+ */
+static int serveSocket(const char *path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    unlink(path);
+    if (listener < 0 || ::bind(listener, (sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(listener, SOMAXCONN) < 0) {
+        perror(path);
+        return 1;
+    }
+
+    vector<shared_ptr<Connection> > connections;
+    vector<string> buffers;
+    while (true) {
+        vector<pollfd> fds(connections.size() + 1);
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (unsigned int i = 0; i < connections.size(); i++) {
+            fds[i + 1].fd = connections[i]->fd;
+            fds[i + 1].events = POLLIN;
+        }
+        if (poll(&fds[0], fds.size(), -1) < 0) continue;
+
+        for (unsigned int i = connections.size(); i > 0; i--) {
+            if (!fds[i].revents) continue;
+            char data[READBUFFER];
+            ssize_t n = read(fds[i].fd, data, sizeof(data));
+            if (n <= 0) {
+                closeConnection(connections[i - 1]);
+                connections.erase(connections.begin() + i - 1);
+                buffers.erase(buffers.begin() + i - 1);
+                continue;
+            }
+            string &buffer = buffers[i - 1];
+            buffer.append(data, n);
+            size_t end;
+            while ((end = buffer.find('\n')) != string::npos) {
+                handleLine(connections[i - 1], buffer.substr(0, end));
+                buffer.erase(0, end + 1);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                connections.push_back(make_shared<Connection>(fd));
+                buffers.push_back(string());
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *socketPath = NULL;
+    poolSize = max((int) thread::hardware_concurrency(), 1);
+    int sharedMB = 0;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "-socket") && more) {
+            socketPath = argv[++i];
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            poolSize = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-hash") && more) {
+            hashMB = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-sharedhash") && more) {
+            sharedMB = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-socket path] [-threads n] [-hash MB] "
+                    "[-sharedhash MB]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    shared = new PlayerShared(sharedMB);
+    vector<thread> pool;
+    for (int i = 0; i < poolSize; i++) {
+        pool.push_back(thread(worker));
+    }
+    cerr << "Done Initialization" << endl;
+
+    int status = 0;
+    if (socketPath) {
+        status = serveSocket(socketPath);
+    } else {
+        shared_ptr<Connection> c = make_shared<Connection>(STDOUT_FILENO);
+        string line;
+        while (getline(cin, line)) {
+            handleLine(c, line);
+        }
+    }
+
+    // Answer everything still queued before going.
+    {
+        lock_guard<mutex> lock(queueLock);
+        closing = true;
+    }
+    queueReady.notify_all();
+    for (unsigned int i = 0; i < pool.size(); i++) {
+        pool[i].join();
+    }
+    delete shared;
+    return status;
+}
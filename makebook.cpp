@@ -0,0 +1,147 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "player.h"
+#include "book.h"
+using namespace std;
+
+// Defaults: book positions up to this many plies in, searched this deep.
+#define BOOKPLIES 6
+#define BOOKDEPTH 12
+#define BUILDHASHMB 32
+
+// Builds the opening book offline. Every position reachable in fewer than
+// the given number of plies is reduced to its canonical image, and the
+// distinct ones are searched to a fixed depth by a pool of threads, each
+// with its own pair of single-threaded players. The result is written to
+// BOOKFILE, or to the file given, for Player to map at startup.
+
+struct Position {
+    uint64_t player, opponent;
+    int ply;
+};
+
+static bool positionLess(const Position &a, const Position &b) {
+    return a.player < b.player || (a.player == b.player && a.opponent < b.opponent);
+}
+
+static bool positionEqual(const Position &a, const Position &b) {
+    return a.player == b.player && a.opponent == b.opponent;
+}
+
+static vector<Position> positions;
+static vector<BookEntry> entries;
+static atomic<size_t> nextPosition(0);
+static int depth;
+
+static void worker() {
+    Player *players[2] = { new Player(WHITE), new Player(BLACK) };
+    for (int k = 0; k < 2; k++) {
+        players[k]->setThreads(1);
+        players[k]->setHashSize(BUILDHASHMB);
+        players[k]->setBook(NULL);
+        players[k]->setSearchDepth(depth);
+    }
+
+    size_t i;
+    while ((i = nextPosition++) < positions.size()) {
+        // Black moves at even plies; passes cannot happen this early.
+        Side side = (positions[i].ply % 2 == 0) ? BLACK : WHITE;
+        char own = (side == BLACK) ? 'b' : 'w';
+        char opp = (side == BLACK) ? 'w' : 'b';
+        char data[64];
+        for (int sq = 0; sq < 64; sq++) {
+            uint64_t bit = 1ULL << sq;
+            data[sq] = (positions[i].player & bit) ? own
+                     : (positions[i].opponent & bit) ? opp : ' ';
+        }
+
+        Player *player = players[side];
+        player->setBoard(data);
+        Move *move = player->doMove(NULL, -1);
+
+        BookEntry &e = entries[i];
+        e.player = positions[i].player;
+        e.opponent = positions[i].opponent;
+        e.score = player->getScore();
+        e.move = move->x + 8 * move->y;
+        e.depth = depth;
+        e.unused = 0;
+        delete move;
+    }
+
+    delete players[0];
+    delete players[1];
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 5) {
+        fprintf(stderr, "usage: %s [plies] [depth] [threads] [file]\n", argv[0]);
+        return 1;
+    }
+    int plies = (argc > 1) ? atoi(argv[1]) : BOOKPLIES;
+    depth = (argc > 2) ? atoi(argv[2]) : BOOKDEPTH;
+    int threads = (argc > 3) ? atoi(argv[3])
+                             : max((int) thread::hardware_concurrency(), 1);
+    const char *path = (argc > 4) ? argv[4] : BOOKFILE;
+
+    // Breadth-first over distinct canonical positions, one ply at a time.
+    Board start;
+    char data[64];
+    start.getBoard(data);
+    Position root;
+    root.player = root.opponent = 0;
+    root.ply = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        if (data[sq] == 'b') root.player |= 1ULL << sq;
+        if (data[sq] == 'w') root.opponent |= 1ULL << sq;
+    }
+    OpeningBook::canonicalize(root.player, root.opponent);
+    vector<Position> level(1, root);
+
+    for (int ply = 0; ply < plies && !level.empty(); ply++) {
+        positions.insert(positions.end(), level.begin(), level.end());
+        vector<Position> next;
+        for (unsigned int i = 0; i < level.size(); i++) {
+            uint64_t P = level[i].player, O = level[i].opponent;
+            uint64_t moves = Board::getMoves(P, O);
+            while (moves) {
+                int sq = __builtin_ctzll(moves);
+                moves &= moves - 1;
+                uint64_t flips = Board::getFlips(sq, P, O);
+                Position child;
+                child.player = O & ~flips;
+                child.opponent = P | flips | (1ULL << sq);
+                child.ply = ply + 1;
+                if (Board::getMoves(child.player, child.opponent) == 0) {
+                    continue;
+                }
+                OpeningBook::canonicalize(child.player, child.opponent);
+                next.push_back(child);
+            }
+        }
+        sort(next.begin(), next.end(), positionLess);
+        next.erase(unique(next.begin(), next.end(), positionEqual), next.end());
+        level.swap(next);
+    }
+
+    fprintf(stderr, "Searching %lu positions to depth %d on %d threads\n",
+            (unsigned long) positions.size(), depth, threads);
+    entries.resize(positions.size());
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.push_back(thread(worker));
+    }
+    for (int t = 0; t < threads; t++) {
+        pool[t].join();
+    }
+
+    if (!OpeningBook::write(path, &entries[0], entries.size())) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return 1;
+    }
+    printf("Wrote %lu positions to %s\n", (unsigned long) entries.size(), path);
+    return 0;
+}
@@ -0,0 +1,312 @@
+#include <cmath>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "mcts.h"
+
+using namespace std;
+
+#define MCTSMAXPATH 128
+
+static const uint64_t CORNERMASK = 0x8100000000000081ULL;
+
+// Each corner, and the X and C squares next to it.
+static const uint64_t CORNERSQUARES[4] = {
+    0x0000000000000001ULL, 0x0000000000000080ULL,
+    0x0100000000000000ULL, 0x8000000000000000ULL
+};
+static const uint64_t CORNERNEIGHBOURS[4] = {
+    0x0000000000000302ULL, 0x000000000000c040ULL,
+    0x0203000000000000ULL, 0x40c0000000000000ULL
+};
+
+/*
+ * Creates a tree with an arena of the given size. Nothing is searched
+ * until search() is called.
+ */
+MonteCarlo::MonteCarlo(size_t megabytes) : _next(1), _playouts(0), _stop(false), _light(true) {
+    _size = max(megabytes * 1024 * 1024 / sizeof(MCTSNode), (size_t) 1);
+    _nodes = new MCTSNode[_size];
+    _side = BLACK;
+    reset(0, MCTSPASS);
+}
+
+MonteCarlo::~MonteCarlo() {
+    delete[] _nodes;
+}
+
+static inline uint64_t nextRandom(uint64_t &state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Picks one of the squares in moves uniformly.
+ */
+static inline int pickSquare(uint64_t moves, uint64_t &rng) {
+    for (int k = nextRandom(rng) % __builtin_popcountll(moves); k > 0; k--) {
+        moves &= moves - 1;
+    }
+    return __builtin_ctzll(moves);
+}
+
+void MonteCarlo::reset(uint32_t index, int move) {
+    MCTSNode &node = _nodes[index];
+    node.visits.store(0, memory_order_relaxed);
+    node.score.store(0, memory_order_relaxed);
+    node.children.store(0, memory_order_relaxed);
+    node.childCount = 0;
+    node.move = move;
+}
+
+/*
+ * Searches board for side until the time manager's target, or for
+ * maxPlayouts playouts when it has no limit, on the given number of
+ * threads. Returns the most visited move, or -1 if there is none.
+ */
+int MonteCarlo::search(const Board &board, Side side, int threads, TimeManager *timer,
+                       uint64_t maxPlayouts) {
+    _root = board;
+    _side = side;
+    _next = 1;
+    _playouts = 0;
+    _stop = false;
+    reset(0, MCTSPASS);
+
+    vector<thread> helpers;
+    for (int id = 1; id < threads; id++) {
+        helpers.push_back(thread(&MonteCarlo::worker, this, id, timer, maxPlayouts));
+    }
+    this->worker(0, timer, maxPlayouts);
+    for (unsigned int i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+
+    int line[1];
+    if (this->principalVariation(line, 1) == 0 || line[0] == MCTSPASS) {
+        return -1;
+    }
+    return line[0];
+}
+
+/*
+ * Runs playouts until the search is stopped: walks down the tree by UCT,
+ * expands the leaf it reaches if it has been visited often enough, plays
+ * the game out from there and backs the result up the path.
+ */
+void MonteCarlo::worker(int id, TimeManager *timer, uint64_t maxPlayouts) {
+    uint64_t rng = 0x9e3779b97f4a7c15ULL * (id + 1);
+    uint32_t path[MCTSMAXPATH];
+    uint64_t count = 0;
+
+    while (!_stop.load(memory_order_relaxed)) {
+        if (++count % MCTSPOLLPLAYOUTS == 0) {
+            uint64_t total = (_playouts += MCTSPOLLPLAYOUTS);
+            if (timer->limited() ? timer->elapsed() >= timer->target()
+                                 : total >= maxPlayouts) {
+                _stop = true;
+            }
+        }
+
+        // The side to move's discs and the other side's; the tree is walked
+        // and played out on these alone, with no hash key to keep up.
+        uint64_t P = (_side == BLACK) ? _root.own<BLACK>() : _root.own<WHITE>();
+        uint64_t O = (_side == BLACK) ? _root.own<WHITE>() : _root.own<BLACK>();
+        Side s = _side;
+        int length = 0;
+        uint32_t index = 0;
+        path[length++] = 0;
+        _nodes[0].visits += VIRTUALLOSS;
+        while (length < MCTSMAXPATH) {
+            MCTSNode &node = _nodes[index];
+            int32_t first = node.children.load(memory_order_acquire);
+            if (first == 0 &&
+                node.visits.load(memory_order_relaxed) >= MCTSEXPANDVISITS + VIRTUALLOSS &&
+                this->expand(node, P, O)) {
+                first = node.children.load(memory_order_acquire);
+            }
+            if (first <= 0) {
+                break;
+            }
+            index = this->select(node);
+            MCTSNode &child = _nodes[index];
+            if (child.move != MCTSPASS) {
+                uint64_t flips = Board::getFlips(child.move, P, O);
+                P ^= flips | (1ULL << child.move);
+                O ^= flips;
+            }
+            swap(P, O);
+            s = otherSide(s);
+            child.visits += VIRTUALLOSS;
+            path[length++] = index;
+        }
+
+        // Black's result in half points; the root was reached by the side
+        // not to move, and sides alternate down the path.
+        int result = this->playout(P, O, s, rng);
+        Side mover = otherSide(_side);
+        for (int i = 0; i < length; i++) {
+            MCTSNode &node = _nodes[path[i]];
+            node.score += (mover == BLACK) ? result : 2 - result;
+            node.visits += 1 - VIRTUALLOSS;
+            mover = otherSide(mover);
+        }
+    }
+    _playouts += count % MCTSPOLLPLAYOUTS;
+}
+
+/*
+ * Gives node a child for each move of the side to move, whose discs are
+ * P, or a single pass child, unless the game is over, another thread got
+ * there first or the arena is full. Returns true if it did.
+ */
+bool MonteCarlo::expand(MCTSNode &node, uint64_t P, uint64_t O) {
+    uint64_t moves = Board::getMoves(P, O);
+    int count = __builtin_popcountll(moves);
+    if (count == 0) {
+        if (Board::getMoves(O, P) == 0) {
+            return false;
+        }
+        count = 1;
+    }
+    if (_next.load(memory_order_relaxed) + count > _size) {
+        return false;
+    }
+    int32_t leaf = 0;
+    if (!node.children.compare_exchange_strong(leaf, -1)) {
+        return false;
+    }
+    uint32_t first = _next.fetch_add(count);
+    if (first + count > _size) {
+        node.children.store(0, memory_order_release);
+        return false;
+    }
+
+    if (moves == 0) {
+        this->reset(first, MCTSPASS);
+    }
+    for (int i = 0; moves; moves &= moves - 1, i++) {
+        this->reset(first + i, __builtin_ctzll(moves));
+    }
+    node.childCount = count;
+    node.children.store(first, memory_order_release);
+    return true;
+}
+
+/*
+ * The child of an expanded node with the best UCT value: its average
+ * result plus an exploration term. Unvisited children come first.
+ */
+uint32_t MonteCarlo::select(MCTSNode &node) {
+    uint32_t first = node.children.load(memory_order_relaxed);
+    double logVisits = log((double) max(node.visits.load(memory_order_relaxed), 1));
+    uint32_t best = first;
+    double bestValue = -1;
+    for (uint32_t i = first; i < first + node.childCount; i++) {
+        int visits = _nodes[i].visits.load(memory_order_relaxed);
+        if (visits <= 0) {
+            return i;
+        }
+        double value = _nodes[i].score.load(memory_order_relaxed) / (2.0 * visits)
+                     + MCTSEXPLORATION * sqrt(logVisits / visits);
+        if (value > bestValue) {
+            bestValue = value;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Plays the game out with s to move, holding discs P against O, and
+ * returns Black's result in half points. The light policy plays a corner
+ * when it can, and otherwise avoids squares next to an empty corner.
+ */
+int MonteCarlo::playout(uint64_t P, uint64_t O, Side s, uint64_t &rng) {
+    bool passed = false;
+    while (true) {
+        uint64_t moves = Board::getMoves(P, O);
+        if (moves == 0) {
+            if (passed) {
+                break;
+            }
+            passed = true;
+            swap(P, O);
+            s = otherSide(s);
+            continue;
+        }
+        passed = false;
+        if (_light) {
+            uint64_t empty = ~(P | O);
+            uint64_t danger = 0;
+            for (int c = 0; c < 4; c++) {
+                if (empty & CORNERSQUARES[c]) {
+                    danger |= CORNERNEIGHBOURS[c];
+                }
+            }
+            if (moves & CORNERMASK) {
+                moves &= CORNERMASK;
+            } else if (moves & ~danger) {
+                moves &= ~danger;
+            }
+        }
+        int square = pickSquare(moves, rng);
+        uint64_t flips = Board::getFlips(square, P, O);
+        uint64_t next = O ^ flips;
+        O = P ^ flips ^ (1ULL << square);
+        P = next;
+        s = otherSide(s);
+    }
+    int diff = __builtin_popcountll(P) - __builtin_popcountll(O);
+    if (s == WHITE) {
+        diff = -diff;
+    }
+    return (diff > 0) ? 2 : (diff == 0) ? 1 : 0;
+}
+
+/*
+ * Writes the most visited line from the root into line, at most
+ * maxLength moves, and returns its length.
+ */
+int MonteCarlo::principalVariation(int *line, int maxLength) {
+    int length = 0;
+    uint32_t index = 0;
+    while (length < maxLength) {
+        MCTSNode &node = _nodes[index];
+        int32_t first = node.children.load(memory_order_acquire);
+        if (first <= 0) {
+            break;
+        }
+        int bestVisits = 0;
+        for (uint32_t i = first; i < (uint32_t) first + node.childCount; i++) {
+            if (_nodes[i].visits > bestVisits) {
+                bestVisits = _nodes[i].visits;
+                index = i;
+            }
+        }
+        if (bestVisits == 0) {
+            break;
+        }
+        line[length++] = _nodes[index].move;
+    }
+    return length;
+}
+
+/*
+ * Average result of the most visited root move, for the side to move.
+ */
+double MonteCarlo::value() {
+    int line[1];
+    if (this->principalVariation(line, 1) == 0) {
+        return 0.5;
+    }
+    uint32_t first = _nodes[0].children;
+    for (uint32_t i = first; i < first + _nodes[0].childCount; i++) {
+        if (_nodes[i].move == line[0]) {
+            return _nodes[i].score / (2.0 * _nodes[i].visits);
+        }
+    }
+    return 0.5;
+}
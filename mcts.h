@@ -0,0 +1,85 @@
+#ifndef __MCTS_H__
+#define __MCTS_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include "common.h"
+#include "board.h"
+#include "timemanager.h"
+
+// Size of the node arena. Once it is used up, leaves are no longer
+// expanded and only played out.
+#define MCTSARENAMB 64
+// A leaf is expanded once it has been visited this often.
+#define MCTSEXPANDVISITS 2
+// UCT exploration constant, for results between 0 and 1.
+#define MCTSEXPLORATION 0.7
+// Visits a thread adds, as losses, to every node on its path until its
+// playout is backed up, so that other threads go down other lines.
+#define VIRTUALLOSS 3
+// Playouts run by a search without a time limit.
+#define MCTSPLAYOUTS 200000
+// Playouts between looks at the clock.
+#define MCTSPOLLPLAYOUTS 16
+#define MCTSPASS 64
+
+/*
+ * One node of the search tree. score is in half points (a win is 2, a
+ * draw 1) for the side that played move to reach the node. Children are
+ * allocated together as one run of the arena: children is the index of
+ * the first one, 0 while the node is a leaf and -1 while a thread is
+ * expanding it.
+ */
+struct MCTSNode {
+    std::atomic<int32_t> visits;
+    std::atomic<int32_t> score;
+    std::atomic<int32_t> children;
+    uint8_t childCount;
+    uint8_t move;
+};
+
+/*
+ * Monte Carlo tree search with UCT selection. All threads share one tree
+ * (tree parallelism), whose nodes come from a fixed arena, and keep apart
+ * with virtual loss. Leaves are scored by playing the game out with
+ * random moves, or with a light policy that takes corners and avoids the
+ * squares next to empty corners.
+ */
+class MonteCarlo {
+
+private:
+    MCTSNode *_nodes;
+    uint32_t _size;
+    std::atomic<uint32_t> _next;
+    std::atomic<uint64_t> _playouts;
+    std::atomic<bool> _stop;
+    bool _light;
+
+    Board _root;
+    Side _side;
+
+    void reset(uint32_t index, int move);
+    bool expand(MCTSNode &node, uint64_t P, uint64_t O);
+    uint32_t select(MCTSNode &node);
+    int playout(uint64_t P, uint64_t O, Side s, uint64_t &rng);
+    void worker(int id, TimeManager *timer, uint64_t maxPlayouts);
+
+public:
+    MonteCarlo(size_t megabytes);
+    ~MonteCarlo();
+
+    int search(const Board &board, Side side, int threads, TimeManager *timer,
+               uint64_t maxPlayouts);
+    void setLightPolicy(bool light) { _light = light; }
+
+    // Results of the last search: playouts run, nodes used, the root's
+    // most visited line (MCTSPASS for a pass), and the best move's result
+    // from 0 (certain loss) to 1 (certain win).
+    uint64_t playouts() { return _playouts; }
+    uint32_t nodesUsed() { return std::min(_next.load(), _size); }
+    int principalVariation(int *line, int maxLength);
+    double value();
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include <cpuid.h>
+#include <immintrin.h>
+#include "movegen.h"
+
+#define INNER 0x7e7e7e7e7e7e7e7eULL
+
+/*
+ * True if the CPU and OS support AVX2.
+ */
+bool cpuHasAVX2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/*
+ * True if the CPU has BMI2 and runs PEXT/PDEP in hardware. AMD parts
+ * before Zen 3 (family 19h) microcode them, which makes the line lookup
+ * slower than the plain fills.
+ */
+bool cpuHasFastBMI2() {
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("bmi2")) {
+        return false;
+    }
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    bool amd = (ebx == 0x68747541);     // "Auth"enticAMD
+    if (!amd) {
+        return true;
+    }
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    int family = ((eax >> 8) & 0xf) + ((eax >> 20) & 0xff);
+    return family >= 0x19;
+}
+
+/*
+ * The four line directions, one per vector lane: +/-1 along a row, +/-8
+ * along a column and +/-9, +/-7 along the diagonals. Every direction but
+ * the column drops the A and H files from the opponent's discs so runs
+ * cannot wrap.
+ */
+#define AVX2SHIFTS _mm256_set_epi64x(7, 9, 8, 1)
+#define AVX2INNER _mm256_set_epi64x(INNER, INNER, -1, INNER)
+
+/*
+ * OR of the four lanes.
+ */
+__attribute__((target("avx2")))
+static inline uint64_t orLanes(__m256i v) {
+    __m128i x = _mm_or_si128(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    return _mm_cvtsi128_si64(_mm_or_si128(x, _mm_unpackhi_epi64(x, x)));
+}
+
+/*
+ * Legal moves in the four directions of the lanes for discs pp against
+ * oo, which has had the edges masked off the rows and diagonals: the
+ * same occluded fills as the scalar version, run towards both ends of
+ * every line at once.
+ */
+__attribute__((target("avx2")))
+static inline __m256i movesLanes(__m256i pp, __m256i oo, __m256i shift, __m256i shift2) {
+    __m256i left = _mm256_and_si256(oo, _mm256_sllv_epi64(pp, shift));
+    __m256i right = _mm256_and_si256(oo, _mm256_srlv_epi64(pp, shift));
+    left = _mm256_or_si256(left, _mm256_and_si256(oo, _mm256_sllv_epi64(left, shift)));
+    right = _mm256_or_si256(right, _mm256_and_si256(oo, _mm256_srlv_epi64(right, shift)));
+
+    __m256i proLeft = _mm256_and_si256(oo, _mm256_sllv_epi64(oo, shift));
+    __m256i proRight = _mm256_srlv_epi64(proLeft, shift);
+    left = _mm256_or_si256(left, _mm256_and_si256(proLeft, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(proRight, _mm256_srlv_epi64(right, shift2)));
+    left = _mm256_or_si256(left, _mm256_and_si256(proLeft, _mm256_sllv_epi64(left, shift2)));
+    right = _mm256_or_si256(right, _mm256_and_si256(proRight, _mm256_srlv_epi64(right, shift2)));
+
+    return _mm256_or_si256(_mm256_sllv_epi64(left, shift),
+                           _mm256_srlv_epi64(right, shift));
+}
+
+/*
+ * Legal moves with four directions per instruction.
+ */
+__attribute__((target("avx2")))
+uint64_t getMovesAVX2(uint64_t P, uint64_t O) {
+    __m256i shift = AVX2SHIFTS;
+    __m256i shift2 = _mm256_add_epi64(shift, shift);
+    __m256i pp = _mm256_set1_epi64x(P);
+    __m256i oo = _mm256_and_si256(_mm256_set1_epi64x(O), AVX2INNER);
+    return orLanes(movesLanes(pp, oo, shift, shift2)) & ~(P | O);
+}
+
+/*
+ * Legal moves of both sides. The two sets of fills do not depend on each
+ * other, so they overlap.
+ */
+__attribute__((target("avx2")))
+void getBothMovesAVX2(uint64_t P, uint64_t O, uint64_t &movesP, uint64_t &movesO) {
+    __m256i shift = AVX2SHIFTS;
+    __m256i shift2 = _mm256_add_epi64(shift, shift);
+    __m256i pp = _mm256_set1_epi64x(P);
+    __m256i oo = _mm256_set1_epi64x(O);
+    __m256i inner = AVX2INNER;
+    __m256i forP = movesLanes(pp, _mm256_and_si256(oo, inner), shift, shift2);
+    __m256i forO = movesLanes(oo, _mm256_and_si256(pp, inner), shift, shift2);
+    uint64_t empty = ~(P | O);
+    movesP = orLanes(forP) & empty;
+    movesO = orLanes(forO) & empty;
+}
+
+/*
+ * Flipped discs with four directions per instruction. Each lane fills
+ * from the move through the opponent's discs and keeps the run only if
+ * one of our discs caps it.
+ */
+__attribute__((target("avx2")))
+uint64_t getFlipsAVX2(int square, uint64_t P, uint64_t O) {
+    __m256i shift = AVX2SHIFTS;
+    __m256i shift2 = _mm256_add_epi64(shift, shift);
+    __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+    __m256i pp = _mm256_set1_epi64x(P);
+    __m256i mm = _mm256_set1_epi64x(1ULL << square);
+    __m256i zero = _mm256_setzero_si256();
+
+    __m256i pro = _mm256_and_si256(_mm256_set1_epi64x(O), AVX2INNER);
+    __m256i left = _mm256_or_si256(mm, _mm256_and_si256(pro, _mm256_sllv_epi64(mm, shift)));
+    __m256i proLeft = _mm256_and_si256(pro, _mm256_sllv_epi64(pro, shift));
+    left = _mm256_or_si256(left, _mm256_and_si256(proLeft, _mm256_sllv_epi64(left, shift2)));
+    proLeft = _mm256_and_si256(proLeft, _mm256_sllv_epi64(proLeft, shift2));
+    left = _mm256_or_si256(left, _mm256_and_si256(proLeft, _mm256_sllv_epi64(left, shift4)));
+
+    __m256i right = _mm256_or_si256(mm, _mm256_and_si256(pro, _mm256_srlv_epi64(mm, shift)));
+    __m256i proRight = _mm256_and_si256(pro, _mm256_srlv_epi64(pro, shift));
+    right = _mm256_or_si256(right, _mm256_and_si256(proRight, _mm256_srlv_epi64(right, shift2)));
+    proRight = _mm256_and_si256(proRight, _mm256_srlv_epi64(proRight, shift2));
+    right = _mm256_or_si256(right, _mm256_and_si256(proRight, _mm256_srlv_epi64(right, shift4)));
+
+    // Lanes whose run is not capped by P come out all ones here.
+    __m256i openLeft = _mm256_cmpeq_epi64(
+        _mm256_and_si256(_mm256_sllv_epi64(left, shift), pp), zero);
+    __m256i openRight = _mm256_cmpeq_epi64(
+        _mm256_and_si256(_mm256_srlv_epi64(right, shift), pp), zero);
+    __m256i flips = _mm256_or_si256(_mm256_andnot_si256(openLeft, left),
+                                    _mm256_andnot_si256(openRight, right));
+    return orLanes(flips) & ~(1ULL << square);
+}
+
+// Columns and diagonals of three or more squares, the lines the move
+// lookup gathers with PEXT; rows are read straight out of their byte.
+#define MOVELINES 30
+
+/*
+ * Tables for the line lookup. A line is read into the low bits of a byte
+ * in board order. OUTFLANK[x][o] holds, for a move at position x and the
+ * opponent's discs o on positions 1-6, the squares where a disc of ours
+ * would cap a run of theirs next to x. FLIPPED[x][f] holds the discs
+ * between x and the capping squares f. MOVES[o][p] holds the legal moves
+ * on a line with the opponent's discs o and ours p; a line shorter than
+ * eight squares reads as empty past its end, and what the table says
+ * about those squares is dropped by PDEP.
+ */
+struct LineTables {
+    uint8_t outflank[8][64];
+    uint8_t flipped[8][256];
+    uint8_t moves[64][256];
+    uint64_t lines[64][4];
+    int positions[64][4];
+    uint64_t moveLines[MOVELINES];
+
+    LineTables() {
+        for (int o = 0; o < 64; o++) {
+            for (int p = 0; p < 256; p++) {
+                int line = o << 1, result = 0;
+                for (int x = 0; x < 8; x++) {
+                    if (p >> x & 1) continue;
+                    int e;
+                    for (e = x + 1; e < 8 && (line >> e & 1); e++);
+                    if (e > x + 1 && e < 8 && (p >> e & 1)) result |= 1 << x;
+                    for (e = x - 1; e >= 0 && (line >> e & 1); e--);
+                    if (e < x - 1 && e >= 0 && (p >> e & 1)) result |= 1 << x;
+                }
+                moves[o][p] = result;
+            }
+        }
+        for (int x = 0; x < 8; x++) {
+            for (int o = 0; o < 64; o++) {
+                int line = o << 1, result = 0, e;
+                for (e = x + 1; e <= 6 && (line >> e & 1); e++);
+                if (e > x + 1 && e <= 7) result |= 1 << e;
+                for (e = x - 1; e >= 1 && (line >> e & 1); e--);
+                if (e < x - 1 && e >= 0) result |= 1 << e;
+                outflank[x][o] = result;
+            }
+            for (int f = 0; f < 256; f++) {
+                int result = 0;
+                for (int e = 0; e < 8; e++) {
+                    if (!(f >> e & 1)) continue;
+                    for (int k = x + 1; k < e; k++) result |= 1 << k;
+                    for (int k = e + 1; k < x; k++) result |= 1 << k;
+                }
+                flipped[x][f] = result;
+            }
+        }
+
+        // Row, column and both diagonals through every square.
+        static const int DX[4] = { 1, 0, 1, -1 };
+        static const int DY[4] = { 0, 1, 1, 1 };
+        for (int sq = 0; sq < 64; sq++) {
+            for (int d = 0; d < 4; d++) {
+                uint64_t mask = 1ULL << sq;
+                for (int sign = -1; sign <= 1; sign += 2) {
+                    int x = sq % 8 + sign * DX[d], y = sq / 8 + sign * DY[d];
+                    for (; x >= 0 && x < 8 && y >= 0 && y < 8;
+                         x += sign * DX[d], y += sign * DY[d]) {
+                        mask |= 1ULL << (x + 8 * y);
+                    }
+                }
+                lines[sq][d] = mask;
+                positions[sq][d] = __builtin_popcountll(mask & ((1ULL << sq) - 1));
+            }
+        }
+
+        // Every column and diagonal once, from the square it starts on.
+        int n = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            for (int d = 1; d < 4; d++) {
+                uint64_t mask = lines[sq][d];
+                if (__builtin_popcountll(mask) >= 3 && __builtin_ctzll(mask) == sq) {
+                    moveLines[n++] = mask;
+                }
+            }
+        }
+    }
+};
+
+static const LineTables LINETABLES;
+
+/*
+ * Flipped discs by line lookup: each of the four lines through the
+ * square is gathered with PEXT, looked up, and the flipped discs put
+ * back with PDEP.
+ */
+__attribute__((target("bmi2")))
+uint64_t getFlipsBMI2(int square, uint64_t P, uint64_t O) {
+    uint64_t flips = 0;
+    for (int d = 0; d < 4; d++) {
+        uint64_t mask = LINETABLES.lines[square][d];
+        int x = LINETABLES.positions[square][d];
+        int o = (_pext_u64(O, mask) >> 1) & 63;
+        int f = LINETABLES.outflank[x][o] & _pext_u64(P, mask);
+        flips |= _pdep_u64(LINETABLES.flipped[x][f], mask);
+    }
+    return flips;
+}
+
+/*
+ * Legal moves by line lookup: every row, column and diagonal long enough
+ * to hold a move is gathered with PEXT, its moves looked up, and the
+ * moves put back with PDEP.
+ */
+__attribute__((target("bmi2")))
+uint64_t getMovesBMI2(uint64_t P, uint64_t O) {
+    uint64_t moves = 0;
+    for (int r = 0; r < 64; r += 8) {
+        moves |= (uint64_t) LINETABLES.moves[(O >> (r + 1)) & 63][(P >> r) & 0xff] << r;
+    }
+    for (int i = 0; i < MOVELINES; i++) {
+        uint64_t mask = LINETABLES.moveLines[i];
+        int o = (_pext_u64(O, mask) >> 1) & 63;
+        moves |= _pdep_u64(LINETABLES.moves[o][_pext_u64(P, mask)], mask);
+    }
+    return moves & ~(P | O);
+}
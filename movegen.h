@@ -0,0 +1,27 @@
+#ifndef __MOVEGEN_H__
+#define __MOVEGEN_H__
+
+#include <cstdint>
+
+// Move generation backends. The board picks one for the CPU at startup
+// and Board::setBackend() can switch; all of them give identical results.
+// BACKENDMIXED takes moves from the AVX2 fills and flips from the PEXT
+// lookup.
+#define BACKENDSCALAR 0
+#define BACKENDAVX2 1
+#define BACKENDBMI2 2
+#define BACKENDMIXED 3
+#define BACKENDS 4
+
+// Vector and bit-extract kernels, compiled for their instruction sets
+// and only called after the CPU has been checked.
+uint64_t getMovesAVX2(uint64_t P, uint64_t O);
+void getBothMovesAVX2(uint64_t P, uint64_t O, uint64_t &movesP, uint64_t &movesO);
+uint64_t getFlipsAVX2(int square, uint64_t P, uint64_t O);
+uint64_t getMovesBMI2(uint64_t P, uint64_t O);
+uint64_t getFlipsBMI2(int square, uint64_t P, uint64_t O);
+
+bool cpuHasAVX2();
+bool cpuHasFastBMI2();
+
+#endif
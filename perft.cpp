@@ -0,0 +1,159 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "common.h"
+#include "board.h"
+
+// Root positions are split this many plies deep and shared out between
+// the threads, so that there are enough of them to keep every thread busy.
+#define SPLITPLIES 2
+
+// Leaf counts from the initial position. A pass counts as a ply, and a
+// finished game counts as one leaf however much depth is left.
+static const uint64_t KNOWNPERFT[] = {
+    1ULL, 4ULL, 12ULL, 56ULL, 244ULL, 1396ULL, 8200ULL, 55092ULL,
+    390216ULL, 3005288ULL, 24571284ULL, 212258800ULL, 1939886636ULL,
+    18429641748ULL, 184042084512ULL
+};
+#define KNOWNDEPTH 14
+
+// Counts the leaves depth plies from a position by walking the whole tree
+// with makeMove()/unmakeMove(), and checks that every unmake puts the
+// Zobrist key back. Validates the move generator against known counts and
+// measures its raw speed.
+// Usage: perft [depth] [threads] [64-char board of b/w/. and side b/w]
+
+struct Task {
+    Board *board;
+    Side side;
+    int depth;
+};
+
+static atomic<uint64_t> keyErrors(0);
+
+static inline Side other(Side s) {
+    return (s == BLACK) ? WHITE : BLACK;
+}
+
+static uint64_t perft(Board *board, Side side, int depth) {
+    if (depth == 0) {
+        return 1;
+    }
+    uint64_t moves = board->getPossibleMoves(side);
+    if (moves == 0) {
+        if (board->getPossibleMoves(other(side)) == 0) {
+            return 1;
+        }
+        return perft(board, other(side), depth - 1);
+    }
+    if (depth == 1) {
+        return __builtin_popcountll(moves);
+    }
+
+    uint64_t key = board->getKey(side);
+    uint64_t nodes = 0;
+    for (; moves; moves &= moves - 1) {
+        int square = __builtin_ctzll(moves);
+        uint64_t flips = board->makeMove(square, side);
+        nodes += perft(board, other(side), depth - 1);
+        board->unmakeMove(square, flips, side);
+    }
+    if (board->getKey(side) != key) {
+        keyErrors++;
+    }
+    return nodes;
+}
+
+/*
+ * Expands the tree to the split depth, playing moves through doMove() on
+ * board copies. Finished games become tasks of depth zero, which count
+ * as one leaf.
+ */
+static void split(Board *board, Side side, int depth, int plies, vector<Task> &tasks) {
+    uint64_t moves = board->getPossibleMoves(side);
+    bool done = moves == 0 && board->getPossibleMoves(other(side)) == 0;
+    if (plies == 0 || depth == 0 || done) {
+        Task task = { board, side, done ? 0 : depth };
+        tasks.push_back(task);
+        return;
+    }
+    if (moves == 0) {
+        split(board, other(side), depth - 1, plies - 1, tasks);
+        return;
+    }
+    for (; moves; moves &= moves - 1) {
+        int square = __builtin_ctzll(moves);
+        Move move(square % 8, square / 8);
+        Board *child = board->copy();
+        child->doMove(&move, side);
+        split(child, other(side), depth - 1, plies - 1, tasks);
+    }
+    delete board;
+}
+
+int main(int argc, char *argv[]) {
+    int maxDepth = (argc > 1) ? atoi(argv[1]) : 11;
+    int threads = (argc > 2) ? atoi(argv[2]) : thread::hardware_concurrency();
+    if (threads < 1) threads = 1;
+
+    Board start;
+    Side side = BLACK;
+    bool custom = argc > 4;
+    if (custom) {
+        if (strlen(argv[3]) != 64) {
+            fprintf(stderr, "board must be 64 characters\n");
+            return 2;
+        }
+        char data[64];
+        memcpy(data, argv[3], 64);
+        start.setBoard(data);
+        side = (argv[4][0] == 'w') ? WHITE : BLACK;
+    }
+
+    int failures = 0;
+    printf("depth            leaves   seconds        Mn/s\n");
+    for (int depth = 1; depth <= maxDepth; depth++) {
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+
+        vector<Task> tasks;
+        split(start.copy(), side, depth, SPLITPLIES, tasks);
+        atomic<unsigned int> next(0);
+        atomic<uint64_t> leaves(0);
+        vector<thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(thread([&]() {
+                for (unsigned int t = next++; t < tasks.size(); t = next++) {
+                    Task &task = tasks[t];
+                    leaves += (task.depth == 0) ? 1 : perft(task.board, task.side, task.depth);
+                }
+            }));
+        }
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+        for (unsigned int t = 0; t < tasks.size(); t++) {
+            delete tasks[t].board;
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        printf("%5d %17llu %9.3f %11.1f", depth, (unsigned long long) leaves.load(),
+               seconds, leaves / seconds / 1e6);
+        if (!custom && depth <= KNOWNDEPTH) {
+            bool ok = leaves == KNOWNPERFT[depth];
+            failures += !ok;
+            printf(ok ? "  ok" : "  WRONG, expected %llu",
+                   (unsigned long long) KNOWNPERFT[depth]);
+        }
+        printf("\n");
+    }
+
+    if (keyErrors) {
+        printf("%llu unmakes left a different key\n", (unsigned long long) keyErrors.load());
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
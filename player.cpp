@@ -1,14 +1,26 @@
+#include <cmath>
 #include "player.h"
 
-bitset<64> EDGES = bitset<64>(0xff818181818181ffULL);
-bitset<64> CORNERS = bitset<64>(0x8100000000000081ULL);
-
 /*
  * Constructor for the player; initialize everything here. The side your AI is
  * on (BLACK or WHITE) is passed in as "side". The constructor must finish 
  * within 30 seconds.
  */
-Player::Player(Side side) : _side(side) {
+Player::Player(Side side) : Player(side, NULL) {
+}
+
+/*
+ * Constructor for a player that uses the book, weights and table in
+ * shared, and small tables of its own, instead of loading everything
+ * itself. With shared NULL it is a stand-alone player. engine is
+ * ENGINEALPHABETA or ENGINEMCTS; an MCTS player gets a tree arena of
+ * MCTSARENAMB.
+ */
+Player::Player(Side side, PlayerShared *shared, int engine)
+    : _side(side),
+      _ownTable(!shared ? HASHSIZEMB : shared->table ? 0 : SESSIONHASHMB),
+      _shared(shared), _engine(engine), _endgame(shared ? SESSIONENDGAMEHASHMB : ENDGAMEHASHMB),
+      _endgameEmpties(ENDGAMEEMPTIES) {
     // Will be set to true in test_minimax.cpp.
     testingMinimax = false;
     
@@ -19,8 +31,30 @@ Player::Player(Side side) : _side(side) {
      */
     _board = new Board();
     _opponentSide = (_side == BLACK) ? (WHITE) : (BLACK);
+    _threads = max((int) thread::hardware_concurrency(), 1);
+    _depth = MINIMAXDEPTH;
+    _ponderMove = -1;
+    _ponders = _ponderHits = 0;
+    _statsLog = NULL;
+    _mcts = (engine == ENGINEMCTS) ? new MonteCarlo(MCTSARENAMB) : NULL;
 
-    this->computeOpening();
+    if (shared) {
+        _table = shared->table ? shared->table : &_ownTable;
+        _book = &shared->book;
+        _ownEval = NULL;
+        _eval = &shared->eval;
+        _probCut = &shared->probCut;
+        return;
+    }
+    // The book is built offline (makebook.cpp) and just mapped here.
+    _table = &_ownTable;
+    _book = &_ownBook;
+    _book->open(BOOKFILE);
+    _ownEval = new Evaluator();
+    _ownEval->load(EVALFILE);
+    _eval = _ownEval;
+    _probCut = &_ownProbCut;
+    _probCut->load(PROBCUTFILE);
     std::cerr << "Done Initialization" << std::endl;
 }
 
@@ -28,10 +62,33 @@ Player::Player(Side side) : _side(side) {
  * Destructor for the player.
  */
 Player::~Player() {
-    _table.clear();
+    this->stopPonder();
+    if (!_shared) {
+        _timer.report(cerr);
+        if (_ponders > 0) {
+            cerr << "ponder hits " << _ponderHits << "/" << _ponders << endl;
+        }
+    }
+    delete _ownEval;
+    delete _mcts;
     delete _board;
 }
 
+/*
+ * Loads the book and weights that players made with this will share, and
+ * allocates the shared table if tableMegabytes is not zero.
+ */
+PlayerShared::PlayerShared(size_t tableMegabytes)
+    : table(tableMegabytes ? new TranspositionTable(tableMegabytes) : NULL) {
+    book.open(BOOKFILE);
+    eval.load(EVALFILE);
+    probCut.load(PROBCUTFILE);
+}
+
+PlayerShared::~PlayerShared() {
+    delete table;
+}
+
 /*
  * Compute the next move given the opponent's last move. Your AI is
  * expected to keep track of the board on its own. If this is the first move,
@@ -49,258 +106,769 @@ Move *Player::doMove(Move *opponentsMove, int msLeft) {
      * TODO: Implement how moves your AI should play here. You should first
      * process the opponent's opponents move before calculating your own move
      */ 
+    // Whatever the ponder search found is in the tables by now.
+    if (this->stopPonder()) {
+        int played = opponentsMove ? opponentsMove->x + 8 * opponentsMove->y : -1;
+        _ponders++;
+        if (played == _ponderMove) {
+            _ponderHits++;
+        }
+    }
     if (opponentsMove) {
 	_board->doMove(opponentsMove, _opponentSide);
     }
-    Move *m = NULL;
-    // If a time limit is specified, the AI will do iterative deepening to 
-    // use up as much time as safely possible.
-    if (msLeft > 0) {
-    	clock_t start = clock();
-
-    	// 500 may be an overestimate. Can optimize later
-    	double time_allowed = (msLeft) / TIMESPLIT;
-    	
-    	int depth = 2;
-
-    	// While there is still time left, it will compute one depth further. While
-    	// it repeats some calculations, that fact that we have a transposition table
-    	// should minimize the time wasted. 
-    	while ( (double)(clock() - start) / (CLOCKS_PER_SEC / 1000) < time_allowed) {
-    	    m = (testingMinimax) ? 
-    		(this->findMinimaxMove(2)) : (this->findMinimaxMove(depth++));
-    	}
-    	/* FOR DEBUGGING
-    	std::cerr << depth << std::endl;
-    	*/
-    } else {
-    	m = (testingMinimax) ? 
-    	    (this->findMinimaxMove(2)) : (this->findMinimaxMove(MINIMAXDEPTH));
+    // The table was seeded with the real heuristic, which the 2-ply test
+    // does not use. A table shared with other games is aged by whoever
+    // owns it, since their searches are still running in it.
+    if (_table == &_ownTable) {
+        if (testingMinimax) {
+            _table->clear();
+        }
+        _table->newSearch();
     }
-    _board->doMove(m, _side);
-    return m;
+    _pv.clear();
+    _timer.beginMove();
+    _stats.clear();
+    _nodes = _endgameNodes = 0;
+    _iterations.clear();
+    
+    int m = -1;
+    const char *source = "pass";
+    int discs = _board->countBlack() + _board->countWhite();
+    // Nothing to search if we have to pass.
+    if (_board->getPossibleMoves(_side) != 0) {
+        // Close to the end, play perfectly if the solver finishes in time;
+        // otherwise fall back to the heuristic search with what is left.
+        int empties = 64 - _board->countBlack() - _board->countWhite();
+        int score;
+        if (!testingMinimax && _book->probe(_board->own(_side), _board->opp(_side),
+                                           m, score)) {
+            _score = score;
+            _pv.push_back(m);
+            source = "book";
+        } else if (!testingMinimax && empties <= _endgameEmpties) {
+            m = this->solveEndgame(msLeft);
+            source = "endgame";
+        }
+        if (m < 0) {
+            source = _mcts ? "mcts" : "search";
+            int remaining = msLeft;
+            if (msLeft > 0) {
+                remaining = max(msLeft - (int) _timer.moveElapsed(), 1);
+            }
+            m = _mcts ? this->searchMCTS(remaining, empties)
+                      : this->searchMove(remaining, empties);
+        }
+    }
+    _timer.endMove();
+    if (_statsLog) {
+        this->logStats(source, discs - 4, m, _timer.moveElapsed());
+    }
+    
+    if (m < 0) {
+        return NULL;
+    }
+    _board->makeMove(m, _side);
+    return new Move(m % 8, m / 8);
 }
 
 /*
- * Returns the first available move that the AI finds.
+ * Picks a move with the heuristic search. If there is a time limit,
+ * the AI will do iterative deepening to use up its share of msLeft: a new
+ * iteration is started while the time manager's target allows it, and an
+ * iteration still running at the hard deadline is abandoned in favour of
+ * the move from the last one that completed.
  */
-Move *Player::findFirstMove() {
-    bitset<64> moves = _board->getPossibleMoves(_side);
-    if (moves.any()) {
-        for (int i = 0; i < 64; i++) {
-            if (moves.test(i)) {
-                return new Move(i % 8, i / 8);
+int Player::searchMove(int msLeft, int empties) {
+    SearchThread main(*_board, 0);
+    _timer.allocate(msLeft, empties, _endgameEmpties);
+    
+    // The 2-ply test has to be reproducible, so it stays single threaded.
+    _stop = false;
+    vector<thread> helpers;
+    for (int id = 1; id < _threads && !testingMinimax; id++) {
+        helpers.push_back(thread(&Player::helperSearch, this, id, _side));
+    }
+    
+    int m = -1;
+    if (testingMinimax) {
+        m = this->findMinimaxMove(&main, 2, _side);
+    } else if (_timer.limited()) {
+        // While there is still time left, it will compute one depth further.
+        // While it repeats some calculations, the transposition table
+        // should minimize the time wasted.
+        for (int depth = 2; depth <= MAXDEPTH; depth++) {
+            uint64_t nodes = main.nodes;
+            int move = this->findMinimaxMove(&main, depth, _side);
+            if (move < 0) {
+                break;
+            }
+            m = move;
+            IterationStats iteration = { depth, _timer.moveElapsed(), main.nodes - nodes };
+            _iterations.push_back(iteration);
+            if (!_timer.canStartIteration()) {
+                break;
             }
         }
+    } else {
+        m = this->findMinimaxMove(&main, _depth, _side);
+        IterationStats iteration = { _depth, _timer.moveElapsed(), main.nodes };
+        _iterations.push_back(iteration);
+    }
+    
+    _stop = true;
+    for (unsigned int i = 0; i < helpers.size(); i++) {
+        helpers[i].join();
+    }
+    this->mergeStats(&main);
+    
+    // Not even the first iteration finished: take any legal move.
+    if (m < 0) {
+        m = this->findFirstMove();
+    }
+    
+    // Keep the principal variation of the last iteration for reporting.
+    _score = main.score;
+    for (int i = 0; i < main.pvLength[0]; i++) {
+        _pv.push_back((main.pv[0][i] == PASS) ? -1 : main.pv[0][i]);
     }
-    return NULL;
+    return m;
+}
+
+/*
+ * Picks a move with Monte Carlo tree search on every thread, playing out
+ * until the time manager's target, or MCTSPLAYOUTS times without a time
+ * limit. The move is the most visited one.
+ */
+int Player::searchMCTS(int msLeft, int empties) {
+    _timer.allocate(msLeft, empties, _endgameEmpties);
+    int m = _mcts->search(*_board, _side, _threads, &_timer, MCTSPLAYOUTS);
+    _nodes = _mcts->playouts();
+
+    int line[MAXPLY];
+    int length = _mcts->principalVariation(line, MAXPLY);
+    for (int i = 0; i < length; i++) {
+        _pv.push_back((line[i] == MCTSPASS) ? -1 : line[i]);
+    }
+    _score = (int) lround((_mcts->value() - 0.5) * 1000);
+    if (m < 0) {
+        m = this->findFirstMove();
+    }
+    return m;
 }
 
 /*
- * Uses the minimax algorithm to look for the best move
+ * Solves the current position exactly and returns the best move, or -1
+ * if the solver did not finish within its share of msLeft.
  */
-Move *Player::findMinimaxMove(int depth) {
-    int alpha = INT_MIN;
-    int beta = INT_MAX;
+int Player::solveEndgame(int msLeft) {
+    _stop = false;
+    _endgame.setStop(&_stop);
+    _timer.allocateEndgame(msLeft);
+    if (_timer.limited()) {
+        _endgame.setDeadline(_timer.hardDeadline());
+    } else {
+        _endgame.clearDeadline();
+    }
     
-    bitset<64> moves = _board->getPossibleMoves(_side);
+    int best, score;
+    uint64_t nodes = _endgame.nodes;
+    bool solved = _endgame.solve(_board->own(_side), _board->opp(_side),
+                                 -64, 64, best, score);
+    _endgameNodes += _endgame.nodes - nodes;
+    if (!solved) {
+        return -1;
+    }
+    _score = score;
+    _pv.push_back(best);
+    return best;
+}
+
+/*
+ * Body of a helper thread. Runs its own iterative deepening for side s on
+ * a copy of the board until told to stop; odd threads run one ply ahead
+ * so the threads spread over different depths. Only the table entries
+ * they leave behind are used.
+ */
+void Player::helperSearch(int id, Side s) {
+    SearchThread t(*_board, id);
     
-    Move *best = new Move(0,0); // Stores best move
-    Move current_move = Move(0,0);
-    Board *next_board;
-    int score;
+    for (int depth = 2 + (id & 1); depth <= MAXDEPTH && !_stop; depth++) {
+        this->findMinimaxMove(&t, depth, s);
+    }
+    this->mergeStats(&t);
+}
+
+/*
+ * Adds a finished search thread's counters to the current move's totals.
+ */
+void Player::mergeStats(SearchThread *t) {
+    lock_guard<mutex> lock(_statsLock);
+    _stats.add(t->stats);
+    _nodes += t->nodes;
+}
+
+/*
+ * Writes the current move's statistics to the stats log as one line of
+ * JSON. Iteration times are per iteration, and the effective branching
+ * factor is the main thread's node ratio between its last two
+ * iterations.
+ */
+void Player::logStats(const char *source, int ply, int move, double ms) {
+    uint64_t nodes = _nodes + _endgameNodes;
+    int depth = _iterations.empty() ? 0 : _iterations.back().depth;
+    double ebf = 0;
+    int n = _iterations.size();
+    if (n >= 2 && _iterations[n - 2].nodes > 0) {
+        ebf = (double) _iterations[n - 1].nodes / _iterations[n - 2].nodes;
+    }
+    
+    string line;
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+             "{\"side\":\"%s\",\"ply\":%d,\"move\":%d,\"source\":\"%s\","
+             "\"score\":%d,\"ms\":%.2f,\"depth\":%d,\"nodes\":%llu,"
+             "\"endgamenodes\":%llu,\"nps\":%.0f,\"ebf\":%.2f",
+             _side == BLACK ? "black" : "white", ply, move, source,
+             (move < 0) ? 0 : _score, ms, depth, (unsigned long long) nodes,
+             (unsigned long long) _endgameNodes,
+             (ms > 0) ? nodes * 1000.0 / ms : 0.0, ebf);
+    line += buffer;
+#ifdef SEARCHSTATS
+    const SearchStats &s = _stats;
+    snprintf(buffer, sizeof(buffer),
+             ",\"evals\":%llu,\"cutoffs\":%llu,\"firstcutoffrate\":%.3f,"
+             "\"ttprobes\":%llu,\"tthits\":%llu,\"tthitrate\":%.3f,"
+             "\"ttcutoffs\":%llu,\"ttstores\":%llu,\"stablecutoffs\":%llu,"
+             "\"probcuts\":%llu",
+             (unsigned long long) s.evals, (unsigned long long) s.cutoffs,
+             s.cutoffs ? (double) s.firstCutoffs / s.cutoffs : 0.0,
+             (unsigned long long) s.ttProbes, (unsigned long long) s.ttHits,
+             s.ttProbes ? (double) s.ttHits / s.ttProbes : 0.0,
+             (unsigned long long) s.ttCutoffs, (unsigned long long) s.ttStores,
+             (unsigned long long) s.stableCutoffs, (unsigned long long) s.probCuts);
+    line += buffer;
+#endif
+    line += ",\"iterations\":[";
+    double previous = 0;
+    for (int i = 0; i < n; i++) {
+        snprintf(buffer, sizeof(buffer), "%s{\"depth\":%d,\"ms\":%.2f,\"nodes\":%llu}",
+                 i ? "," : "", _iterations[i].depth, _iterations[i].ms - previous,
+                 (unsigned long long) _iterations[i].nodes);
+        line += buffer;
+        previous = _iterations[i].ms;
+    }
+    line += "]}\n";
+    
+    // One write per line, so players sharing a log do not interleave.
+    fputs(line.c_str(), _statsLog);
+    fflush(_statsLog);
+}
+
+/*
+ * Starts searching the position after our move on the opponent's time.
+ * All of the opponent's replies are searched as one root, which puts most
+ * of the effort into the reply we expect; the results are left in the
+ * tables for the next doMove(). Close to the end the endgame solver
+ * ponders instead, so its own table is the one that gets filled. The
+ * search runs until stopPonder() is called.
+ */
+void Player::startPonder() {
+    this->stopPonder();
+    if (_board->isDone() || testingMinimax || _mcts) {
+        return;
+    }
+    _ponderMove = (_pv.size() > 1) ? _pv[1] : -1;
     
+    _stop = false;
+    int empties = 64 - _board->countBlack() - _board->countWhite();
+    if (empties - 1 <= _endgameEmpties) {
+        _ponderThreads.push_back(thread(&Player::ponderEndgame, this));
+        return;
+    }
+    // Helper ids only: the main thread id would poll our move's clock.
+    for (int id = 1; id <= _threads; id++) {
+        _ponderThreads.push_back(thread(&Player::helperSearch, this, id,
+                                        _opponentSide));
+    }
+}
+
+/*
+ * Stops a running ponder search and waits for it. Returns true if there
+ * was one.
+ */
+bool Player::stopPonder() {
+    if (_ponderThreads.empty()) {
+        return false;
+    }
+    _stop = true;
+    for (unsigned int i = 0; i < _ponderThreads.size(); i++) {
+        _ponderThreads[i].join();
+    }
+    _ponderThreads.clear();
+    return true;
+}
+
+/*
+ * Body of the endgame ponder thread: solves the opponent's position with
+ * no deadline until it finishes or is stopped.
+ */
+void Player::ponderEndgame() {
+    if (_board->getPossibleMoves(_opponentSide) == 0) {
+        return;
+    }
+    _endgame.setStop(&_stop);
+    _endgame.clearDeadline();
+    int best, score;
+    _endgame.solve(_board->own(_opponentSide), _board->own(_side),
+                   -64, 64, best, score);
+}
+
+/*
+ * Returns the square of the first available move that the AI finds, or
+ * -1 if it has to pass.
+ */
+int Player::findFirstMove() {
+    uint64_t moves = _board->getPossibleMoves(_side);
+    return (moves) ? __builtin_ctzll(moves) : -1;
+}
+
+/*
+ * Creates the state for a search thread starting from board, with empty
+ * killer and history tables.
+ */
+SearchThread::SearchThread(const Board &board, int id)
+    : board(board), id(id), ply(0), nodes(0), score(0), completedDepth(0) {
+    Evaluator::initState(eval, board.black, board.white);
+    for (int i = 0; i < MAXPLY; i++) {
+        killers[i][0] = killers[i][1] = NOMOVE;
+        pvLength[i] = 0;
+    }
     for (int i = 0; i < 64; i++) {
-        if (moves.test(i)) {
-            current_move = Move(i % 8, i / 8);
-            next_board = _board->copy();
-            next_board->doMove(&current_move, _side);
-            
-            score = this->minimaxHelper(depth - 1, next_board, _opponentSide, alpha, beta);
-            if (score >= alpha) {
-                alpha = score;
-                best->setX(current_move.getX());
-                best->setY(current_move.getY());
+        history[WHITE][i] = history[BLACK][i] = 0;
+    }
+}
+
+// Static move priorities: corners first, then the A and B squares on the
+// edges, with the X and C squares next to an empty corner last.
+static const int SQUAREPRIORITY[64] = {
+    9, 2, 8, 6, 6, 8, 2, 9,
+    2, 1, 3, 4, 4, 3, 1, 2,
+    8, 3, 7, 5, 5, 7, 3, 8,
+    6, 4, 5, 0, 0, 5, 4, 6,
+    6, 4, 5, 0, 0, 5, 4, 6,
+    8, 3, 7, 5, 5, 7, 3, 8,
+    2, 1, 3, 4, 4, 3, 1, 2,
+    9, 2, 8, 6, 6, 8, 2, 9
+};
+
+#define STAGE_HASH 0
+#define STAGE_KILLER 1
+#define STAGE_SCORE 3
+#define STAGE_REST 4
+
+/*
+ * Staged move picker for side S. Hands out the hash move first, then the thread's
+ * two killer moves for this ply, and only then scores and sorts the rest
+ * by history and square priority. A cutoff on one of the early moves
+ * never pays for the sort. With fastestFirst set, moves that leave the
+ * opponent fewer replies also sort earlier.
+ */
+template <Side S>
+class MovePicker {
+private:
+    SearchThread *_t;
+    uint64_t _moves;
+    int _hashMove;
+    bool _fastestFirst;
+    int _stage;
+    int _count, _next;
+    int _squares[64];
+    int _scores[64];
+
+    /*
+     * Takes square out of the remaining moves if it is still in them.
+     */
+    inline bool take(int square) {
+        if (square != NOMOVE && (_moves & (1ULL << square))) {
+            _moves &= ~(1ULL << square);
+            return true;
+        }
+        return false;
+    }
+
+    void scoreMoves() {
+        _count = _next = 0;
+        while (_moves) {
+            int i = __builtin_ctzll(_moves);
+            _moves &= _moves - 1;
+            int score = _t->history[S][i] + PRIORITYWEIGHT * SQUAREPRIORITY[i];
+            if (_fastestFirst) {
+                uint64_t flips = _t->board.makeMove<S>(i);
+                score -= MOBILITYORDERWEIGHT * __builtin_popcountll(
+                    _t->board.getPossibleMoves<otherSide(S)>());
+                _t->board.unmakeMove<S>(i, flips);
             }
-            
+            _squares[_count] = i;
+            _scores[_count] = score;
+            _count++;
         }
     }
-    return best;
+
+public:
+    MovePicker(SearchThread *t, uint64_t moves, int hashMove, bool fastestFirst)
+        : _t(t), _moves(moves), _hashMove(hashMove),
+          _fastestFirst(fastestFirst), _stage(STAGE_HASH), _count(0), _next(0) {}
+
+    /*
+     * Returns the next move to search, or -1 when there are none left.
+     */
+    int next() {
+        switch (_stage) {
+        case STAGE_HASH:
+            _stage++;
+            if (take(_hashMove)) return _hashMove;
+            // fall through
+        case STAGE_KILLER:
+        case STAGE_KILLER + 1:
+            while (_stage < STAGE_SCORE) {
+                int killer = _t->killers[_t->ply][_stage - STAGE_KILLER];
+                _stage++;
+                if (take(killer)) return killer;
+            }
+            // fall through
+        case STAGE_SCORE:
+            _stage++;
+            scoreMoves();
+            // fall through
+        default:
+            if (_next == _count) return -1;
+            int best = _next;
+            for (int j = _next + 1; j < _count; j++) {
+                if (_scores[j] > _scores[best]) best = j;
+            }
+            int square = _squares[best];
+            _squares[best] = _squares[_next];
+            _scores[best] = _scores[_next];
+            _next++;
+            return square;
+        }
+    }
+};
+
+/*
+ * Halves side s's history scores, keeping their order.
+ */
+static inline void ageHistory(SearchThread *t, Side s) {
+    for (int i = 0; i < 64; i++) {
+        t->history[s][i] /= 2;
+    }
 }
 
 /*
- * Helper function that recursively searches for the minimax
- * solution. Returns a pair including the optimized score alpha/beta
- * and the best move.
+ * Records that square caused a cutoff for side s at the thread's current
+ * ply, as a killer move and in the history table.
  */
-int Player::minimaxHelper(int depth, Board *b, Side s, int alpha, int beta) {
-    // Base Case: Just evaluate board
+static inline void updateOrdering(SearchThread *t, Side s, int square, int depth) {
+    int *killers = t->killers[t->ply];
+    if (killers[0] != square) {
+        killers[1] = killers[0];
+        killers[0] = square;
+    }
+    t->history[s][square] += depth * depth;
+    if (t->history[s][square] > HISTORYMAX) {
+        ageHistory(t, s);
+    }
+}
+
+/*
+ * Searches the root to the given depth and returns the best move's
+ * square, or -1 if the search was stopped first. From ASPIRATIONDEPTH on,
+ * the search starts with a narrow window around the previous iteration's
+ * score and widens it on the side that failed. The thread's score and
+ * principal variation are updated when an iteration completes.
+ */
+int Player::findMinimaxMove(SearchThread *t, int depth, Side s) {
+    int alpha = -INFSCORE;
+    int beta = INFSCORE;
+    int window = ASPIRATIONWINDOW;
+    
+    // Cutoffs from shallower iterations count half as much as this one's.
+    ageHistory(t, BLACK);
+    ageHistory(t, WHITE);
+    
+    if (t->completedDepth >= ASPIRATIONDEPTH) {
+        alpha = max(t->score - window, -INFSCORE);
+        beta = min(t->score + window, INFSCORE);
+    }
+    
+    while (true) {
+        int score = (s == BLACK) ? this->minimaxHelper<BLACK>(t, depth, alpha, beta)
+                                 : this->minimaxHelper<WHITE>(t, depth, alpha, beta);
+        if (_stop) {
+            return -1;
+        }
+        
+        window *= 2;
+        if (score <= alpha) {
+            alpha = max(score - window, -INFSCORE);
+        } else if (score >= beta) {
+            beta = min(score + window, INFSCORE);
+        } else {
+            t->score = score;
+            t->completedDepth = depth;
+            return t->pv[0][0];
+        }
+    }
+}
+
+/*
+ * Negamax principal variation search. Returns the score of the position
+ * for S, the side to move, searched depth plies deep. The first move is
+ * searched with the full window and every later one with a null window
+ * that only proves it is no better; a move that fails that test high is
+ * searched again with the full window.
+ *
+ * Children are searched in place: each move is made on the thread's board
+ * and taken back afterwards, so the search never copies or allocates a
+ * board. Once the search is stopped it unwinds without storing anything.
+ *
+ * Results are stored in the transposition table along with whether they
+ * are exact or only a bound for the window they were searched with, so
+ * they can be reused for any later window they still answer. Nodes on
+ * the principal variation do not take cutoffs from the table, so their
+ * PV line stays complete.
+ */
+template <Side S>
+int Player::minimaxHelper(SearchThread *t, int depth, int alpha, int beta) {
+    if (_stop.load(memory_order_relaxed)) {
+        return 0;
+    }
+    // The main thread watches the clock and stops everyone at the hard
+    // deadline.
+    if (++t->nodes % POLLNODES == 0 && t->id == 0 && _timer.hardExpired()) {
+        _stop = true;
+        return 0;
+    }
+    Board *b = &t->board;
+    bool pvNode = (beta - alpha > 1);
+    int ply = t->ply;
+    t->pvLength[ply] = 0;
+    
+    // Base Case: Just evaluate board. Leaves are cheaper to evaluate than
+    // to look up.
     if (depth == 0) {
-	    return this->evaluate(b);
+        STAT(t, evals);
+	    return this->evaluate<S>(t);
     }
-    bitset<64> moves = b->getPossibleMoves(s);
     
-    // There are no more possible moves
-    if (moves.none()) {
-        return this->evaluate(b);
+    uint64_t key = b->getKey<S>();
+    TTEntry entry;
+    int hashMove = NOMOVE;
+    STAT(t, ttProbes);
+    if (_table->probe(key, entry)) {
+        STAT(t, ttHits);
+        if (!pvNode && entry.depth >= depth) {
+            if (entry.bound == BOUND_EXACT ||
+                (entry.bound == BOUND_LOWER && entry.score >= beta) ||
+                (entry.bound == BOUND_UPPER && entry.score <= alpha)) {
+                STAT(t, ttCutoffs);
+                return entry.score;
+            }
+        }
+        hashMove = entry.move;
+    }
+    
+    // Stability cutoff: a side with more than half the board stable has
+    // won, by at least that margin.
+    int stableBound;
+    if (this->stabilityCutoff<S>(b, alpha, beta, stableBound)) {
+        STAT(t, stableCutoffs);
+        return stableBound;
     }
     
-    Move current_move = Move(0,0);
-    Board *next_board;
+    uint64_t moves = b->getPossibleMoves<S>();
+    
+    // No moves: the game is over if the opponent cannot move either,
+    // otherwise we pass and the opponent moves again.
+    if (moves == 0) {
+        if (b->getPossibleMoves<otherSide(S)>() == 0) {
+            return this->finalScore(b, S);
+        }
+        t->ply++;
+        int score = -this->minimaxHelper<otherSide(S)>(t, depth, -beta, -alpha);
+        t->ply--;
+        this->updatePV(t, PASS);
+        return score;
+    }
+    
+    // Multi-ProbCut: away from the principal variation, a shallow search
+    // may show that the full one would almost surely fall outside the
+    // window.
+    int probBound;
+    if (!pvNode && depth >= MPCMINDEPTH && !testingMinimax &&
+        this->probCut<S>(t, depth, alpha, beta, probBound)) {
+        STAT(t, probCuts);
+        return probBound;
+    }
+    
+    int origAlpha = alpha;
+    int bestScore = -INFSCORE;
+    int best = NOMOVE;
     int score;
+    int i;
+    int searched = 0;
+    MovePicker<S> picker(t, moves, hashMove, depth >= FASTESTFIRSTDEPTH || ply == 0);
     
-    if (s == _side) {
-        alpha = INT_MIN;
-        for (int i = 0; i < 64; i++) {
-            if (moves.test(i)) {
-                current_move = Move(i % 8, i / 8);
-                next_board = b->copy();
-                next_board->doMove(&current_move, s);
-                
-                //Wants to maximize the possible score
-                score = this->minimaxHelper(depth - 1, next_board, _opponentSide, alpha, beta);
-                delete next_board;
-                alpha = max(alpha, score);
-                if (beta <= alpha) {
-                    break;
-                }
+    while ((i = picker.next()) >= 0) {
+        searched++;
+        uint64_t flips = b->makeMove<S>(i);
+        Evaluator::update<S>(t->eval, i, flips);
+        t->ply++;
+        if (best == NOMOVE) {
+            score = -this->minimaxHelper<otherSide(S)>(t, depth - 1, -beta, -alpha);
+        } else {
+            score = -this->minimaxHelper<otherSide(S)>(t, depth - 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) {
+                score = -this->minimaxHelper<otherSide(S)>(t, depth - 1, -beta, -alpha);
             }
         }
-        return alpha;
-    } else {
-        beta = INT_MAX;
-        for (int i = 0; i < 64; i++) {
-            if (moves.test(i)) {
-                current_move = Move(i % 8, i / 8);
-                next_board = b->copy();
-                next_board->doMove(&current_move, s);
-                
-                //Wants to maximize the possible score
-                score = this->minimaxHelper(depth - 1, next_board, _side, alpha, beta);
-                delete next_board;
-                beta = min(beta, score);
-                if (beta <= alpha) {
+        t->ply--;
+        b->unmakeMove<S>(i, flips);
+        Evaluator::restore<S>(t->eval, i, flips);
+        if (_stop.load(memory_order_relaxed)) {
+            return 0;
+        }
+        
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+            if (score > alpha) {
+                alpha = score;
+                this->updatePV(t, i);
+                if (alpha >= beta) {
+                    STAT(t, cutoffs);
+                    if (searched == 1) {
+                        STAT(t, firstCutoffs);
+                    }
+                    updateOrdering(t, S, i, depth);
                     break;
                 }
             }
         }
-        return beta;
     }
+    
+    int bound = BOUND_EXACT;
+    if (bestScore <= origAlpha) {
+        bound = BOUND_UPPER;
+    } else if (bestScore >= beta) {
+        bound = BOUND_LOWER;
+    }
+    STAT(t, ttStores);
+    _table->store(key, depth, bound, bestScore, best);
+    return bestScore;
 }
 
 /*
- * Heuristic that evaluates the score of a given board
- * configuration.
- */ 
-int Player::evaluate(Board *b) {
-    if (testingMinimax) {
-	return b->count(_side) - b->count(_opponentSide);
+ * Makes square, followed by the child's principal variation, the
+ * principal variation at the thread's current ply.
+ */
+void Player::updatePV(SearchThread *t, int square) {
+    int ply = t->ply;
+    t->pv[ply][0] = square;
+    int length = (ply + 1 < MAXPLY) ? t->pvLength[ply + 1] : 0;
+    for (int i = 0; i < length; i++) {
+        t->pv[ply][i + 1] = t->pv[ply + 1][i];
     }
-    else {
-	// Compute the bitsets for ai and opponent sides, and converts
-	// to a 64-bit integer
-	unsigned long long ai_side, total;
-	if (_side == BLACK) {
-	    ai_side = (b->black).to_ullong();
-	    total = (b->taken).to_ullong();
-	}
-	else {
-	    ai_side = (~(b->black) & (b->taken)).to_ullong();
-	    total = (b->taken).to_ullong();
-	}
-	
-	// Hash value is simply concatenation of 2 integers
-    // TODO: hash minimax helper instead?
-	string hash = to_string(ai_side) + ", " + to_string(total);
-	if (_table.find(hash) != _table.end()) {
-	    return _table[hash];
-	}
-	else {
-	    int score = 0;
-        bitset<64> white = (b->taken & ~(b->black));
-        
-        // Check for winning board
-        if ((b->black).count() == 0) {
-            return (_side == BLACK) ? INT_MIN : INT_MAX;
-        } else if (white.count() == 0) {
-            return (_side == WHITE) ? INT_MIN : INT_MAX;
+    t->pvLength[ply] = length + 1;
+}
+
+/*
+ * Score of a finished game for side s: a win or loss outranks any
+ * heuristic score, and the disc margin breaks ties between them.
+ */
+int Player::finalScore(Board *b, Side s) {
+    int diff = b->count(s) - b->count((s == BLACK) ? WHITE : BLACK);
+    if (diff > 0) return WINSCORE + diff;
+    if (diff < 0) return -WINSCORE + diff;
+    return 0;
+}
+
+/*
+ * Checks whether stable discs alone decide the game beyond the window.
+ * If so stores the bound they give in bound and returns true. Only
+ * computes stability when a side has enough discs for it to matter.
+ */
+template <Side S>
+bool Player::stabilityCutoff(Board *b, int alpha, int beta, int &bound) {
+    uint64_t own = b->own<S>();
+    uint64_t opp = b->opp<S>();
+    if (__builtin_popcountll(own) > 32) {
+        int stable = __builtin_popcountll(Board::getStable(own, opp));
+        if (stable > 32 && WINSCORE + 2 * stable - 64 >= beta) {
+            bound = WINSCORE + 2 * stable - 64;
+            return true;
         }
-        
-        // Coin count
-        score += (b->black).count() - white.count();
-        
-        // Edges and corners
-        score += EDGEWEIGHT * (b->black & EDGES).count();
-        score += CORNERWEIGHT * (b->black & CORNERS).count();
-        score -= EDGEWEIGHT * (white & EDGES).count();
-        score -= CORNERWEIGHT * (white & CORNERS).count();
-        
-        // Mobility
-//        bitset<64> next_moves;
-//        next_moves = b->getPossibleMoves(BLACK);
-//        score += next_moves.count();
-//        next_moves = b->getPossibleMoves(WHITE);
-//        score -= next_moves.count();
-        
-        // Stability
-//        score += STABILITYWEIGHT * b->getStablePieceCount(BLACK);
-//        score -= STABILITYWEIGHT * b->getStablePieceCount(WHITE);
-        
-        if (_side == WHITE) {
-            score *= -1;
+    }
+    if (__builtin_popcountll(opp) > 32) {
+        int stable = __builtin_popcountll(Board::getStable(opp, own));
+        if (stable > 32 && -WINSCORE + 64 - 2 * stable <= alpha) {
+            bound = -WINSCORE + 64 - 2 * stable;
+            return true;
         }
-	    
-	    // Keeps transposition table at fixed size
-	    if (_table.size() >= 100000) {
-		// Removes the first key, since it is probably the furthest 
-		// away from the current game state
-		_table.erase(_table.begin());
-	    }
-	    _table[hash] = score;
-	    return score;
-	} 
     }
+    return false;
 }
 
 /*
- * Stores the score of positions early in the game so they can be 
- * looked up quickly.
+ * Checks whether a shallow search predicts, with the calibrated error,
+ * that searching depth plies deep would fail high or low by a margin of
+ * MPCTHRESHOLD standard deviations. If so stores the bound to return in
+ * bound and returns true. Won and lost scores are not predicted.
  */
-void Player::computeOpening() {
-    vector<pair<Side, Board *> > positions;
-    positions.push_back(make_pair(_side, _board->copy()));
-    
-    // Computes initial 25000 board positions, and stores their 
-    // score in the transposition table
-    
-    // TODO: if time is limited, don't fill table all the way here
-        
-    while (_table.size() < 25000) {
-	    pair<Side, Board *> curr = positions.front();
-	    this->evaluate(curr.second);
-	
-    	positions.erase(positions.begin());
-
-        bitset<64> moves = curr.second->getPossibleMoves(curr.first);
-        Side next_side = (curr.first == BLACK) ? (WHITE) : (BLACK);
-        Move current_move = Move(0,0);
-        
-        for (int i = 0; i < 64; i++) {
-            if (moves.test(i)) {
-                current_move = Move(i % 8, i / 8);
-                Board *next_board = curr.second->copy();
-                next_board->doMove(&current_move, curr.first);
-                positions.push_back(make_pair(next_side, next_board));
-            }
-        }
-        delete curr.second;
+template <Side S>
+bool Player::probCut(SearchThread *t, int depth, int alpha, int beta, int &bound) {
+    Board *b = &t->board;
+    const ProbCutParams *p = _probCut->params(Evaluator::phase(b->own<S>(), b->opp<S>()),
+                                              depth);
+    if (!p || alpha <= -WINSCORE / 2 || beta >= WINSCORE / 2) {
+        return false;
     }
-    
-    while (!positions.empty()) {
-	pair<Side, Board *> it = positions.back();
-	positions.pop_back();
-	delete it.second;
+    double margin = MPCTHRESHOLD * p->sigma;
+    int high = (int) ceil((beta + margin - p->b) / p->a);
+    if (high < WINSCORE / 2 &&
+        this->minimaxHelper<S>(t, p->shallow, high - 1, high) >= high) {
+        bound = beta;
+        return true;
+    }
+    int low = (int) floor((alpha - margin - p->b) / p->a);
+    if (low > -WINSCORE / 2 &&
+        this->minimaxHelper<S>(t, p->shallow, low, low + 1) <= low) {
+        bound = alpha;
+        return true;
     }
-	
+    return false;
 }
 
+/*
+ * Heuristic that evaluates the score of a search thread's board for
+ * side S.
+ */ 
+template <Side S>
+int Player::evaluate(SearchThread *t) {
+    Board *b = &t->board;
+    uint64_t own = b->own<S>();
+    uint64_t opp = b->opp<S>();
+    if (testingMinimax) {
+	return __builtin_popcountll(own) - __builtin_popcountll(opp);
+    }
+    else {
+        // Check for winning board
+        if (own == 0 || opp == 0) {
+            return this->finalScore(b, S);
+        }
+        
+        // Patterns and mobility
+        return _eval->evaluate<S>(t->eval, own, opp);
+    }
+}
@@ -2,19 +2,102 @@
 #define __PLAYER_H__
 
 #include <climits>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "common.h"
 #include "board.h"
+#include "transposition.h"
+#include "endgame.h"
+#include "timemanager.h"
+#include "book.h"
+#include "eval.h"
+#include "probcut.h"
+#include "mcts.h"
+#include "searchstats.h"
 
 #define MINIMAXDEPTH 8
-#define EDGEWEIGHT 2
-#define CORNERWEIGHT 16
-#define MOBILITYWEIGHT 4
-#define STABILITYWEIGHT 4
-#define TIMESPLIT 100
+#define HASHSIZEMB 64
+#define SESSIONHASHMB 4
+#define SESSIONENDGAMEHASHMB 1
+#define MAXDEPTH 60
+#define MAXPLY 128
+#define PASS 64
+#define WINSCORE 100000
+#define INFSCORE 1000000
+#define ASPIRATIONDEPTH 4
+#define ASPIRATIONWINDOW (EVALSCALE / 2)
+#define PRIORITYWEIGHT 64
+// A history score past this halves its side's table, so that recent
+// cutoffs outweigh old ones and the scores never overflow.
+#define HISTORYMAX (1 << 16)
+// Fastest-first ordering is used this far from the leaves and beyond,
+// not near them: a leaf's children are not searched, so knowing their
+// replies there only costs a move generation per child.
+#define FASTESTFIRSTDEPTH 3
+#define MOBILITYORDERWEIGHT 256
+
+// Search engines a Player can be made with: the alpha-beta search, or
+// Monte Carlo tree search.
+#define ENGINEALPHABETA 0
+#define ENGINEMCTS 1
 
 using namespace std;
 
+/*
+ * Data that many players in one process can share instead of each
+ * loading its own: the opening book, the evaluation weights and the
+ * ProbCut parameters, which are only read once loaded, and optionally
+ * one transposition table for
+ * all their searches. Players made with it also get small tables of
+ * their own, so that a process can hold hundreds of games.
+ */
+struct PlayerShared {
+    OpeningBook book;
+    Evaluator eval;
+    ProbCut probCut;
+    TranspositionTable *table;
+    
+    PlayerShared(size_t tableMegabytes);
+    ~PlayerShared();
+};
+
+/*
+ * State owned by one search thread. Each thread searches its own copy of
+ * the board with its own move-ordering tables; everything else it touches
+ * is shared through the player.
+ */
+struct SearchThread {
+    Board board;
+    int id;
+    int ply;
+    uint64_t nodes;
+    
+    // Two killer moves per ply, and history scores indexed by side and
+    // square.
+    int killers[MAXPLY][2];
+    int history[2][64];
+    
+    // Triangular principal variation table: pv[ply] is the best line
+    // found from ply on, PASS marking a pass.
+    uint8_t pv[MAXPLY][MAXPLY];
+    int pvLength[MAXPLY];
+    
+    // Pattern indices of the board, updated with every move searched.
+    EvalState eval;
+    
+    // Score of the last completed iteration and its depth.
+    int score;
+    int completedDepth;
+    
+    SearchStats stats;
+    
+    SearchThread(const Board &board, int id);
+};
+
 class Player {
 
 private:
@@ -22,21 +105,157 @@ private:
     Side _side;
     Side _opponentSide;
     
-    // Transposition table
-    unordered_map<string, int> _table;
+    // Transposition table, shared by all search threads, and with other
+    // players when the PlayerShared they were made with has one
+    TranspositionTable _ownTable;
+    TranspositionTable *_table;
+    PlayerShared *_shared;
+    
+    // Lazy SMP: helper threads search the same root alongside the main
+    // thread and speed it up through the table.
+    int _threads;
+    atomic<bool> _stop;
+    
+    int findFirstMove();
+    int findMinimaxMove(SearchThread *t, int depth, Side s);
+    template <Side S> int minimaxHelper(SearchThread *t, int depth, int alpha, int beta);
+    void updatePV(SearchThread *t, int square);
+    void helperSearch(int id, Side s);
+    int searchMove(int msLeft, int empties);
+    
+    // Engine picked at construction, and the tree when it is MCTS
+    int _engine;
+    MonteCarlo *_mcts;
+    int searchMCTS(int msLeft, int empties);
     
-    Move *findFirstMove();
-    Move *findMinimaxMove(int depth);
-    int minimaxHelper(int depth, Board *b, Side s, int alpha, int beta);
+    // Wall-clock budget for each move
+    TimeManager _timer;
     
-    void computeOpening();
-    int evaluate(Board *b);
+    // Exact solver for the last ENDGAMEEMPTIES empties, with its own table
+    EndgameSolver _endgame;
+    int _endgameEmpties;
+    int solveEndgame(int msLeft);
+    
+    // Pondering: threads searching on the opponent's time, the reply we
+    // expect, and how often the opponent played it
+    vector<thread> _ponderThreads;
+    int _ponderMove;
+    int _ponders;
+    int _ponderHits;
+    void ponderEndgame();
+    
+    // Principal variation and score of the last search
+    vector<int> _pv;
+    int _score;
+    
+    // Opening book mapped from BOOKFILE, and the fixed search depth used
+    // when there is no time limit
+    OpeningBook _ownBook;
+    OpeningBook *_book;
+    int _depth;
+    
+    // Pattern evaluation, with weights from EVALFILE if there is one; the
+    // player's own, or the shared one
+    Evaluator *_ownEval;
+    Evaluator *_eval;
+    template <Side S> int evaluate(SearchThread *t);
+    int finalScore(Board *b, Side s);
+    template <Side S> bool stabilityCutoff(Board *b, int alpha, int beta, int &bound);
+    
+    // Multi-ProbCut parameters from PROBCUTFILE; the player's own, or the
+    // shared ones
+    ProbCut _ownProbCut;
+    ProbCut *_probCut;
+    template <Side S> bool probCut(SearchThread *t, int depth, int alpha, int beta, int &bound);
+    
+    // Instrumentation of the current move: counters and nodes added up
+    // over every search thread, the main thread's iterations, and where
+    // the per-move JSON lines go (NULL for nowhere)
+    SearchStats _stats;
+    uint64_t _nodes;
+    uint64_t _endgameNodes;
+    vector<IterationStats> _iterations;
+    mutex _statsLock;
+    FILE *_statsLog;
+    void mergeStats(SearchThread *t);
+    void logStats(const char *source, int ply, int move, double ms);
 public:
     Player(Side side);
+    Player(Side side, PlayerShared *shared, int engine = ENGINEALPHABETA);
     ~Player();
     
     Move *doMove(Move *opponentsMove, int msLeft);
-    inline void setBoard(char data[]) { _board->setBoard(data); }
+    inline void setBoard(char data[]) { stopPonder(); _board->setBoard(data); }
+    inline void setHashSize(int megabytes) {
+        _table = &_ownTable;
+        _ownTable.resize(megabytes);
+    }
+    inline void setThreads(int threads) { _threads = max(threads, 1); }
+    inline void setEndgameEmpties(int empties) { _endgameEmpties = empties; }
+    inline void setSearchDepth(int depth) { _depth = min(max(depth, 1), MAXDEPTH); }
+    
+    // Searches every move for ms milliseconds, whatever the clock says; 0
+    // goes back to sharing out the clock.
+    inline void setMoveTime(int ms) { _timer.setMoveTime(ms); }
+    
+    // Forgets every searched position, so that the next search does not
+    // depend on the ones before it. A table shared with other games is
+    // left alone.
+    inline void clearHash() { if (_table == &_ownTable) _table->clear(); }
+    
+    // Maps a different opening book; NULL plays without one.
+    inline bool setBook(const char *path) {
+        _book = &_ownBook;
+        _ownBook.close();
+        return path && _ownBook.open(path);
+    }
+    
+    // Loads evaluation weights from a different file; NULL, or a file that
+    // cannot be read, uses the built-in defaults.
+    inline bool setWeights(const char *path) {
+        if (!_ownEval) {
+            _ownEval = new Evaluator();
+        }
+        _eval = _ownEval;
+        if (path && _eval->load(path)) {
+            return true;
+        }
+        _eval->setDefault();
+        return false;
+    }
+    
+    // Reads different ProbCut parameters; NULL, or a file that cannot be
+    // read, searches full width.
+    inline bool setProbCut(const char *path) {
+        _probCut = &_ownProbCut;
+        _ownProbCut.clear();
+        return path && _ownProbCut.load(path);
+    }
+    
+    // Best line found by the last doMove(), starting with the move it
+    // played; -1 is a pass. The score is from this player's side, and is
+    // the final disc difference when the endgame solver chose the move.
+    // From MCTS it is the expected result in thousandths above an even
+    // game (-500 to 500), and the node count is the number of playouts.
+    inline const vector<int> &getPV() { return _pv; }
+    inline int getScore() { return _score; }
+    inline uint64_t getNodes() { return _nodes + _endgameNodes; }
+    // Moves so far that finished past their hard deadline.
+    inline int getOverruns() { return _timer.overruns(); }
+    
+    // Random playouts instead of the light policy (MCTS only).
+    inline void setLightPlayouts(bool light) {
+        if (_mcts) _mcts->setLightPolicy(light);
+    }
+    
+    // Writes one JSON line of search statistics per move to out, which
+    // stays owned by the caller; NULL turns the report off.
+    inline void setStatsLog(FILE *out) { _statsLog = out; }
+    
+    // Search on the opponent's time after replying; doMove() stops it.
+    // MCTS players do not ponder.
+    void startPonder();
+    bool stopPonder();
     
     // Flag to tell if the player is running within the test_minimax context
     bool testingMinimax;
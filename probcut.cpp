@@ -0,0 +1,79 @@
+#include <cstdio>
+#include "probcut.h"
+
+/*
+ * Creates an empty set of parameters, which never cuts.
+ */
+ProbCut::ProbCut() {
+    clear();
+}
+
+void ProbCut::clear() {
+    for (int phase = 0; phase < EVALPHASES; phase++) {
+        for (int depth = 0; depth <= MPCMAXDEPTH; depth++) {
+            _params[phase][depth].shallow = -1;
+        }
+    }
+}
+
+/*
+ * Reads parameters written by save(), one "phase depth shallow a b sigma"
+ * line per depth pair. Returns false, with nothing loaded, if the file is
+ * missing or a line does not parse.
+ */
+bool ProbCut::load(const char *path) {
+    clear();
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    bool ok = true;
+    int phase, depth;
+    ProbCutParams p;
+    int n;
+    while ((n = fscanf(f, "%d %d %d %lf %lf %lf", &phase, &depth, &p.shallow,
+                       &p.a, &p.b, &p.sigma)) == 6) {
+        if (phase < 0 || phase >= EVALPHASES || depth < MPCMINDEPTH ||
+            depth > MPCMAXDEPTH || p.shallow < 1 || p.shallow >= depth || p.a <= 0) {
+            ok = false;
+            break;
+        }
+        _params[phase][depth] = p;
+    }
+    fclose(f);
+    if (!ok || n != EOF) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool ProbCut::save(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    for (int phase = 0; phase < EVALPHASES; phase++) {
+        for (int depth = 0; depth <= MPCMAXDEPTH; depth++) {
+            const ProbCutParams &p = _params[phase][depth];
+            if (p.shallow >= 0) {
+                fprintf(f, "%d %d %d %.4f %.1f %.1f\n", phase, depth, p.shallow,
+                        p.a, p.b, p.sigma);
+            }
+        }
+    }
+    return fclose(f) == 0;
+}
+
+/*
+ * Depth of the shallow search that predicts one depth plies deep: about
+ * half as deep, and an even number of plies shallower so that both end
+ * with the same side to move.
+ */
+int ProbCut::shallowDepth(int depth) {
+    int shallow = depth / 2;
+    if ((depth - shallow) % 2) {
+        shallow--;
+    }
+    return shallow > 0 ? shallow : 1;
+}
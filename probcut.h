@@ -0,0 +1,56 @@
+#ifndef __PROBCUT_H__
+#define __PROBCUT_H__
+
+#include "eval.h"
+
+#define PROBCUTFILE "probcut.params"
+
+// Searches from MPCMINDEPTH to MPCMAXDEPTH plies deep may be cut short by
+// a shallow search; a cut needs the shallow score to be MPCTHRESHOLD
+// standard deviations past the window.
+#define MPCMINDEPTH 3
+#define MPCMAXDEPTH 20
+#define MPCTHRESHOLD 1.5
+// Depth pairs with fewer calibration samples than this are left out.
+#define MPCMINSAMPLES 30
+
+/*
+ * How a search depth plies deep relates to the shallow one that predicts
+ * it, in one game phase: deep = a * shallow + b, with errors of standard
+ * deviation sigma, all in evaluation units.
+ */
+struct ProbCutParams {
+    int shallow;
+    double a;
+    double b;
+    double sigma;
+};
+
+/*
+ * Multi-ProbCut parameters for every phase and depth, fitted offline by
+ * "analyze -calibrate" and read from PROBCUTFILE. Depths without
+ * parameters, and every depth when nothing is loaded, are searched full
+ * width.
+ */
+class ProbCut {
+
+private:
+    ProbCutParams _params[EVALPHASES][MPCMAXDEPTH + 1];
+
+public:
+    ProbCut();
+
+    void clear();
+    bool load(const char *path);
+    bool save(const char *path);
+
+    inline const ProbCutParams *params(int phase, int depth) {
+        if (depth > MPCMAXDEPTH || _params[phase][depth].shallow < 0) return NULL;
+        return &_params[phase][depth];
+    }
+    void set(int phase, int depth, const ProbCutParams &p) { _params[phase][depth] = p; }
+
+    static int shallowDepth(int depth);
+};
+
+#endif
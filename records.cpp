@@ -0,0 +1,112 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include "gamerecord.h"
+using namespace std;
+
+// Reads game files written by tournament -record (see gamerecord.h) and
+// replays every game through Board to check that its moves are legal.
+// It prints, for each file, how many games and moves it holds, how they
+// ended and how fast they were replayed, then every player id's score.
+// With -positions it writes every position a side moved from instead,
+// one per line as 64 characters of b, w or . and the side to move (b or
+// w), which is the format analyze and tournament -openings read; the
+// summary then goes to stderr.
+//
+// Usage: records [-positions] file...
+
+struct Tally {
+    int games;
+    double points;
+};
+
+int main(int argc, char *argv[]) {
+    bool positions = false;
+    int first = 1;
+    if (argc > 1 && !strcmp(argv[1], "-positions")) {
+        positions = true;
+        first = 2;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [-positions] file...\n", argv[0]);
+        return 2;
+    }
+    FILE *summary = positions ? stderr : stdout;
+
+    map<int, Tally> players;
+    int status = 0;
+    for (int i = first; i < argc; i++) {
+        GameReader reader;
+        if (!reader.open(argv[i])) {
+            fprintf(stderr, "%s: not a game file\n", argv[i]);
+            status = 1;
+            continue;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        uint64_t games = 0, moves = 0, illegal = 0, forfeits = 0;
+        uint64_t outcomes[3] = { 0, 0, 0 };
+        char line[67];
+        line[64] = ' ';
+        line[66] = '\n';
+        GameRecord game;
+        while (reader.next(game)) {
+            GameReplay replay(game);
+            for (; !replay.done(); replay.next()) {
+                if (positions) {
+                    Board &b = replay.board();
+                    uint64_t black = b.own<BLACK>(), white = b.own<WHITE>();
+                    for (int sq = 0; sq < 64; sq++) {
+                        line[sq] = (black >> sq & 1) ? 'b' : (white >> sq & 1) ? 'w' : '.';
+                    }
+                    line[65] = (replay.side() == BLACK) ? 'b' : 'w';
+                    fwrite(line, 1, sizeof(line), stdout);
+                }
+            }
+            if (!replay.legal()) {
+                illegal++;
+            }
+            if (game.forfeit) {
+                forfeits++;
+            }
+            games++;
+            moves += replay.ply();
+            outcomes[(game.result > 0) ? 0 : (game.result == 0) ? 1 : 2]++;
+
+            double black = (game.result > 0) ? 1 : (game.result == 0) ? 0.5 : 0;
+            players[game.black].games++;
+            players[game.black].points += black;
+            players[game.white].games++;
+            players[game.white].points += 1 - black;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        fprintf(summary, "%s: %llu games, %llu moves, black +%llu =%llu -%llu, "
+                "%.0f games/s\n", argv[i], (unsigned long long) games,
+                (unsigned long long) moves, (unsigned long long) outcomes[0],
+                (unsigned long long) outcomes[1], (unsigned long long) outcomes[2],
+                seconds > 0 ? games / seconds : 0.0);
+        if (forfeits > 0) {
+            fprintf(summary, "%s: %llu games decided by forfeit\n", argv[i],
+                    (unsigned long long) forfeits);
+        }
+        if (illegal > 0) {
+            fprintf(summary, "%s: %llu games with an illegal move\n", argv[i],
+                    (unsigned long long) illegal);
+            status = 1;
+        }
+        if (reader.damaged()) {
+            fprintf(summary, "%s: damaged record at byte %llu\n", argv[i],
+                    (unsigned long long) reader.offset());
+            status = 1;
+        }
+    }
+
+    for (map<int, Tally>::iterator it = players.begin(); it != players.end(); it++) {
+        fprintf(summary, "player %d: %d games, %.1f points (%.1f%%)\n", it->first,
+                it->second.games, it->second.points,
+                100.0 * it->second.points / it->second.games);
+    }
+    return status;
+}
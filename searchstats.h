@@ -0,0 +1,63 @@
+#ifndef __SEARCHSTATS_H__
+#define __SEARCHSTATS_H__
+
+#include <cstdint>
+
+// Search counters are compiled in unless NOSEARCHSTATS is defined ("make
+// STATS=0"), in which case STAT() expands to nothing and the per-move
+// report only carries what the search keeps anyway: nodes, depth and
+// time.
+#ifndef NOSEARCHSTATS
+#define SEARCHSTATS
+#define STAT(t, counter) ((t)->stats.counter++)
+#else
+#define STAT(t, counter) ((void) 0)
+#endif
+
+/*
+ * Counters kept by one search thread without any synchronisation, and
+ * added up over all threads at the end of a move.
+ */
+struct SearchStats {
+    uint64_t evals;
+    uint64_t cutoffs;
+    uint64_t firstCutoffs;
+    uint64_t ttProbes;
+    uint64_t ttHits;
+    uint64_t ttCutoffs;
+    uint64_t ttStores;
+    uint64_t stableCutoffs;
+    uint64_t probCuts;
+
+    SearchStats() { clear(); }
+
+    void clear() {
+        evals = cutoffs = firstCutoffs = 0;
+        ttProbes = ttHits = ttCutoffs = ttStores = 0;
+        stableCutoffs = probCuts = 0;
+    }
+
+    void add(const SearchStats &s) {
+        evals += s.evals;
+        cutoffs += s.cutoffs;
+        firstCutoffs += s.firstCutoffs;
+        ttProbes += s.ttProbes;
+        ttHits += s.ttHits;
+        ttCutoffs += s.ttCutoffs;
+        ttStores += s.ttStores;
+        stableCutoffs += s.stableCutoffs;
+        probCuts += s.probCuts;
+    }
+};
+
+/*
+ * One completed iteration of the main search thread: its depth, how long
+ * it took and how many nodes it searched.
+ */
+struct IterationStats {
+    int depth;
+    double ms;
+    uint64_t nodes;
+};
+
+#endif
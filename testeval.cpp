@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "board.h"
+#include "eval.h"
+using namespace std;
+
+// Plies walked from the initial position, and from each position of the
+// random games, whose number and seed are fixed so that runs repeat.
+#define STARTDEPTH 5
+#define GAMEDEPTH 3
+#define GAMES 100
+#define SEED 12345
+
+// Walks game trees with makeMove()/unmakeMove(), keeping an EvalState up
+// to date with Evaluator::update() and restore() the way the search does,
+// and checks at every node, passes included, that both sides' indices are
+// the ones Evaluator::extract() reads from the board. A wrong entry in
+// SQUAREINSTANCES would otherwise only show as slightly worse play.
+// Usage: testeval
+
+static uint64_t nodes = 0, passes = 0, errors = 0;
+
+/*
+ * Compares the state against the board's indices as seen by both sides.
+ */
+static void check(const Board &b, const EvalState &state) {
+    int black[EVALINSTANCES], white[EVALINSTANCES];
+    Evaluator::extract(b.own<BLACK>(), b.own<WHITE>(), black);
+    Evaluator::extract(b.own<WHITE>(), b.own<BLACK>(), white);
+    nodes++;
+    if (memcmp(black, state.indices[BLACK], sizeof(black)) != 0 ||
+        memcmp(white, state.indices[WHITE], sizeof(white)) != 0) {
+        errors++;
+    }
+}
+
+template <Side S>
+static void walk(Board &b, EvalState &state, int depth) {
+    check(b, state);
+    if (depth == 0) {
+        return;
+    }
+    uint64_t moves = b.getPossibleMoves<S>();
+    if (moves == 0) {
+        if (b.getPossibleMoves<otherSide(S)>() != 0) {
+            passes++;
+            walk<otherSide(S)>(b, state, depth - 1);
+        }
+        return;
+    }
+    for (; moves; moves &= moves - 1) {
+        int square = __builtin_ctzll(moves);
+        uint64_t flips = b.makeMove<S>(square);
+        Evaluator::update<S>(state, square, flips);
+        walk<otherSide(S)>(b, state, depth - 1);
+        Evaluator::restore<S>(state, square, flips);
+        b.unmakeMove<S>(square, flips);
+    }
+    check(b, state);
+}
+
+/*
+ * Walks the tree below b with side to move, from a freshly built state.
+ */
+static void walkFrom(Board &b, Side side, int depth) {
+    EvalState state;
+    Evaluator::initState(state, b.own<BLACK>(), b.own<WHITE>());
+    if (side == BLACK) {
+        walk<BLACK>(b, state, depth);
+    } else {
+        walk<WHITE>(b, state, depth);
+    }
+}
+
+int main() {
+    Board start;
+    walkFrom(start, BLACK, STARTDEPTH);
+
+    // Random games reach the late positions, and the passes, that the
+    // first plies do not.
+    srand(SEED);
+    for (int g = 0; g < GAMES; g++) {
+        Board b;
+        Side side = BLACK;
+        while (true) {
+            uint64_t moves = b.getPossibleMoves(side);
+            if (moves == 0) {
+                if (b.getPossibleMoves(otherSide(side)) == 0) {
+                    break;
+                }
+                side = otherSide(side);
+                continue;
+            }
+            walkFrom(b, side, GAMEDEPTH);
+            for (int k = rand() % __builtin_popcountll(moves); k > 0; k--) {
+                moves &= moves - 1;
+            }
+            b.makeMove(__builtin_ctzll(moves), side);
+            side = otherSide(side);
+        }
+    }
+
+    printf("%llu nodes, %llu passes, %llu wrong states\n", (unsigned long long) nodes,
+           (unsigned long long) passes, (unsigned long long) errors);
+    return (errors || passes == 0) ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "board.h"
+#include "movegen.h"
+using namespace std;
+
+#define GAMES 2000
+#define ROUNDS 20
+
+// Checks that every move generation backend this CPU supports gives the
+// same moves and flips as the scalar one, over the positions of random
+// games, then times getMoves() and getFlips() on each.
+// Usage: testmovegen
+
+struct Position {
+    uint64_t player, opponent;
+};
+
+int main() {
+    // Positions from reproducible random games, with both sides to move.
+    vector<Position> positions;
+    srand(2015);
+    for (int g = 0; g < GAMES; g++) {
+        uint64_t P = 0x0000000810000000ULL, O = 0x0000001008000000ULL;
+        while (true) {
+            uint64_t moves = Board::getMoves(P, O);
+            if (moves == 0) {
+                swap(P, O);
+                if (Board::getMoves(P, O) == 0) break;
+                continue;
+            }
+            Position pos = { P, O };
+            positions.push_back(pos);
+            for (int k = rand() % __builtin_popcountll(moves); k > 0; k--) {
+                moves &= moves - 1;
+            }
+            int sq = __builtin_ctzll(moves);
+            uint64_t flips = Board::getFlips(sq, P, O);
+            uint64_t next = O & ~flips;
+            O = P | flips | (1ULL << sq);
+            P = next;
+        }
+    }
+
+    printf("default backend: %s\n", Board::backendName(Board::getBackend()));
+
+    // Reference results from the scalar backend.
+    Board::setBackend(BACKENDSCALAR);
+    vector<uint64_t> moves, flips;
+    for (unsigned int i = 0; i < positions.size(); i++) {
+        Position &p = positions[i];
+        moves.push_back(Board::getMoves(p.player, p.opponent));
+        uint64_t empty = ~(p.player | p.opponent);
+        for (; empty; empty &= empty - 1) {
+            flips.push_back(Board::getFlips(__builtin_ctzll(empty), p.player, p.opponent));
+        }
+    }
+    printf("%lu positions, %lu flip calls\n",
+           (unsigned long) positions.size(), (unsigned long) flips.size());
+
+    int failures = 0;
+    double base[2] = { 0, 0 };
+    printf("backend   moves ns  flips ns  speedup\n");
+    for (int b = 0; b < BACKENDS; b++) {
+        if (!Board::setBackend(b)) {
+            printf("%-8s  not supported on this CPU\n", Board::backendName(b));
+            continue;
+        }
+
+        size_t f = 0;
+        int mismatches = 0;
+        for (unsigned int i = 0; i < positions.size(); i++) {
+            Position &p = positions[i];
+            mismatches += Board::getMoves(p.player, p.opponent) != moves[i];
+            uint64_t movesP, movesO;
+            Board::getMoves(p.player, p.opponent, movesP, movesO);
+            mismatches += movesP != moves[i]
+                       || movesO != Board::getMoves(p.opponent, p.player);
+            uint64_t empty = ~(p.player | p.opponent);
+            for (; empty; empty &= empty - 1) {
+                mismatches += Board::getFlips(__builtin_ctzll(empty), p.player,
+                                              p.opponent) != flips[f++];
+            }
+        }
+        failures += mismatches;
+
+        // Time both calls, folding the results into a checksum so the
+        // compiler cannot drop them.
+        uint64_t sum = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; r++) {
+            for (unsigned int i = 0; i < positions.size(); i++) {
+                sum += Board::getMoves(positions[i].player, positions[i].opponent);
+            }
+        }
+        double movesNs = chrono::duration<double, nano>(
+            chrono::steady_clock::now() - start).count() / (ROUNDS * positions.size());
+
+        start = chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; r++) {
+            for (unsigned int i = 0; i < positions.size(); i++) {
+                Position &p = positions[i];
+                uint64_t empty = ~(p.player | p.opponent);
+                for (; empty; empty &= empty - 1) {
+                    sum += Board::getFlips(__builtin_ctzll(empty), p.player, p.opponent);
+                }
+            }
+        }
+        double flipsNs = chrono::duration<double, nano>(
+            chrono::steady_clock::now() - start).count() / (ROUNDS * flips.size());
+
+        if (b == BACKENDSCALAR) {
+            base[0] = movesNs;
+            base[1] = flipsNs;
+        }
+        printf("%-8s  %8.2f  %8.2f  %.2fx/%.2fx%s (%llx)\n", Board::backendName(b),
+               movesNs, flipsNs, base[0] / movesNs, base[1] / flipsNs,
+               mismatches ? "  MISMATCH" : "", (unsigned long long) (sum & 0xfff));
+    }
+
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "gamerecord.h"
+using namespace std;
+
+// Replays a few hand-made game records and checks that GameReplay plays
+// the legal ones through and stops at the first illegal move, including
+// a move onto a square that is already taken. Then writes a game file
+// and checks that a forfeit reads back marked as one.
+// Usage: testrecords
+
+/*
+ * Replays game to the end and checks where it stopped and whether it was
+ * found legal. Returns the number of failures.
+ */
+static int check(const char *name, const GameRecord &game, bool legal, int ply) {
+    GameReplay replay(game);
+    while (replay.next()) {
+    }
+    bool ok = replay.legal() == legal && replay.ply() == ply;
+    printf("%-24s %s after %d moves  %s\n", name, replay.legal() ? "legal" : "illegal",
+           replay.ply(), ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main() {
+    Board start;
+    GameRecord game;
+    game.black = 1;
+    game.white = 2;
+    game.result = 0;
+    game.forfeit = false;
+    game.standardStart = true;
+    game.startBlack = start.own<BLACK>();
+    game.startWhite = start.own<WHITE>();
+    game.firstSide = BLACK;
+
+    int failures = 0;
+
+    // d3 c3 c4: black, white, black, all legal from the standard start.
+    const uint8_t legal[] = { 19, 18, 26 };
+    game.moves = legal;
+    game.count = 3;
+    failures += check("legal opening", game, true, 3);
+
+    // d3 then a second d3, onto black's own disc.
+    const uint8_t twice[] = { 19, 19 };
+    game.moves = twice;
+    game.count = 2;
+    failures += check("square played twice", game, false, 1);
+
+    // a1 onto a white disc: white holds a1, b1 and d1, black c1, so a
+    // move at a1 would flank b1 if the square were not checked.
+    const uint8_t occupied[] = { 0 };
+    game.standardStart = false;
+    game.startBlack = 1ULL << 2;
+    game.startWhite = (1ULL << 0) | (1ULL << 1) | (1ULL << 3);
+    game.moves = occupied;
+    game.count = 1;
+    failures += check("occupied square", game, false, 0);
+
+    // e1 is black's only move there.
+    const uint8_t only[] = { 4 };
+    game.moves = only;
+    failures += check("custom start", game, true, 1);
+
+    // a8 flanks nothing.
+    const uint8_t nothing[] = { 56 };
+    game.moves = nothing;
+    failures += check("no flips", game, false, 0);
+
+    // The legal opening again, once played out and once as a forfeit.
+    char path[] = "/tmp/testrecordsXXXXXX";
+    int fd = mkstemp(path);
+    GameRecordWriter writer;
+    bool written = fd >= 0 && writer.open(path);
+    game.standardStart = true;
+    game.moves = legal;
+    game.count = 3;
+    written = written && writer.append(game);
+    game.forfeit = true;
+    game.result = 64;
+    written = written && writer.append(game) && writer.close();
+    GameReader reader;
+    GameRecord first, second;
+    bool read = written && reader.open(path) && reader.next(first) && reader.next(second);
+    bool ok = read && !first.forfeit && second.forfeit && second.result == 64;
+    printf("%-24s %s  %s\n", "forfeit flag", read ? "read back" : "not read back",
+           ok ? "ok" : "FAILED");
+    failures += ok ? 0 : 1;
+    reader.close();
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "common.h"
+#include "player.h"
+#include "board.h"
+
+#define POSITIONS 8
+#define RANDOMPLIES 20
+// Milliseconds MCTS gets for each position.
+#define MCTSTESTMS 500
+
+// Measures how the parallel search scales: searches the same midgame
+// positions to MINIMAXDEPTH with 1 to N threads and reports the time to
+// depth and the speedup over one thread. With "mcts", the MCTS engine
+// gets a fixed time per position instead, and playouts per second are
+// reported.
+// Usage: testsmp [max threads] [mcts]
+int main(int argc, char *argv[]) {
+    int maxThreads = (argc > 1) ? atoi(argv[1]) : thread::hardware_concurrency();
+    if (maxThreads < 1) maxThreads = 1;
+    bool mcts = (argc > 2 && !strcmp(argv[2], "mcts"));
+
+    // Reproducible midgame positions from random play.
+    char positions[POSITIONS][64];
+    Side toMove[POSITIONS];
+    srand(2015);
+    for (int p = 0; p < POSITIONS; p++) {
+        Board board;
+        Side side = BLACK;
+        for (int ply = 0; ply < RANDOMPLIES; ply++) {
+            uint64_t moves = board.getPossibleMoves(side);
+            if (moves) {
+                for (int k = rand() % __builtin_popcountll(moves); k > 0; k--) {
+                    moves &= moves - 1;
+                }
+                board.makeMove(__builtin_ctzll(moves), side);
+            }
+            side = (side == BLACK) ? WHITE : BLACK;
+        }
+        board.getBoard(positions[p]);
+        toMove[p] = side;
+    }
+
+    int engine = mcts ? ENGINEMCTS : ENGINEALPHABETA;
+    Player *players[2] = { new Player(WHITE, NULL, engine), new Player(BLACK, NULL, engine) };
+    double base = 0;
+    printf(mcts ? "threads playouts/s   speedup\n" : "threads   seconds   speedup\n");
+    for (int threads = 1; threads <= maxThreads; threads++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        uint64_t playouts = 0;
+        for (int p = 0; p < POSITIONS; p++) {
+            Player *player = players[toMove[p]];
+            player->setThreads(threads);
+            player->setHashSize(HASHSIZEMB);
+            player->setMoveTime(mcts ? MCTSTESTMS : 0);
+            player->setBoard(positions[p]);
+            delete player->doMove(NULL, -1);
+            playouts += player->getNodes();
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (mcts) {
+            double rate = playouts / seconds;
+            if (threads == 1) base = rate;
+            printf("%7d %12.0f %9.2f\n", threads, rate, rate / base);
+        } else {
+            if (threads == 1) base = seconds;
+            printf("%7d %9.3f %9.2f\n", threads, seconds, base / seconds);
+        }
+    }
+
+    delete players[0];
+    delete players[1];
+    return 0;
+}
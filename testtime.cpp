@@ -0,0 +1,67 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "book.h"
+#include "player.h"
+using namespace std;
+
+// Milliseconds on the clock for every move, and how long to wait after a
+// search so that its hard deadline has long passed.
+#define CLOCKMS 1000
+#define WAITMS 400
+
+// Plays a pass and a book move, each right after a search on the clock,
+// and checks that neither counts as overrunning the search's deadline.
+// Usage: testtime
+
+/*
+ * Searches the opening on the clock with the book off, then waits until
+ * the search's hard deadline is well behind us.
+ */
+static void search(Player &player, char *start) {
+    player.setBook(NULL);
+    player.setBoard(start);
+    delete player.doMove(NULL, CLOCKMS);
+    this_thread::sleep_for(chrono::milliseconds(WAITMS));
+}
+
+/*
+ * Prints whether the player has overrun no move so far. Returns the
+ * number of failures.
+ */
+static int check(const char *name, Player &player, bool played) {
+    bool ok = played && player.getOverruns() == 0;
+    printf("%-24s %d overruns  %s\n", name, player.getOverruns(), ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main() {
+    char start[64], pass[64];
+    for (int i = 0; i < 64; i++) {
+        start[i] = pass[i] = ' ';
+    }
+    start[27] = start[36] = 'w';
+    start[28] = start[35] = 'b';
+    // Black's only disc is cut off from White's, so Black must pass.
+    pass[0] = 'w';
+    pass[63] = 'b';
+
+    Player player(BLACK);
+    int failures = 0;
+
+    search(player, start);
+    failures += check("search", player, true);
+
+    player.setBoard(pass);
+    Move *move = player.doMove(NULL, CLOCKMS);
+    failures += check("pass after a search", player, move == NULL);
+
+    search(player, start);
+    player.setBook(BOOKFILE);
+    player.setBoard(start);
+    move = player.doMove(NULL, CLOCKMS);
+    failures += check("book move after a search", player, move != NULL);
+    delete move;
+
+    return failures ? 1 : 0;
+}
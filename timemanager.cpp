@@ -0,0 +1,131 @@
+#include <algorithm>
+#include "timemanager.h"
+
+using namespace std;
+
+/*
+ * Creates a time manager with no budget set.
+ */
+TimeManager::TimeManager() : _limited(false), _moveTime(0), _target(0), _hard(0), _overruns(0) {
+    _moveStart = _budgetStart = _hardDeadline = chrono::steady_clock::now();
+}
+
+/*
+ * Milliseconds since the given time.
+ */
+double TimeManager::since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Marks the start of our move. Until a search allocates a budget the move
+ * has none, so a pass or a book move is not held to the deadline of the
+ * search before it.
+ */
+void TimeManager::beginMove() {
+    _moveStart = chrono::steady_clock::now();
+    _limited = false;
+}
+
+/*
+ * Marks the end of our move and records how long it took. A move counts
+ * as an overrun if it finished more than OVERRUNMS after its hard
+ * deadline.
+ */
+void TimeManager::endMove() {
+    _latencies.push_back(moveElapsed());
+    if (_limited && chrono::steady_clock::now()
+                    > _hardDeadline + chrono::milliseconds(OVERRUNMS)) {
+        _overruns++;
+    }
+}
+
+/*
+ * Sets the budget for a heuristic search starting now, with msLeft on our
+ * clock and the given number of empty squares. The remaining time is
+ * split over our moves until the solver takes over at endgameEmpties,
+ * with more of it going to the midgame than to the opening. With a
+ * fixed move time, the search gets whatever the move has left of it.
+ */
+void TimeManager::allocate(int msLeft, int empties, int endgameEmpties) {
+    _budgetStart = chrono::steady_clock::now();
+    if (_moveTime > 0) {
+        allocateFixed(max(_moveTime - moveElapsed(), 1.0));
+        return;
+    }
+    _limited = (msLeft > 0);
+    if (!_limited) {
+        return;
+    }
+
+    double usable = max(msLeft - SAFETYMS, msLeft / 2);
+    int movesToGo = max((empties - endgameEmpties + 1) / 2, 0) + ENDGAMEMOVES;
+    movesToGo = max(movesToGo, MINMOVESTOGO);
+
+    double phase = 1.0;
+    if (empties > 44) {
+        phase = 0.7;
+    } else if (empties > 28) {
+        phase = 1.3;
+    }
+
+    _hard = usable / MAXSHARE;
+    _target = min(usable / movesToGo * phase, _hard);
+    _hard = min(_target * HARDFACTOR, _hard);
+    _hardDeadline = _budgetStart + chrono::microseconds((long long)(_hard * 1000));
+}
+
+/*
+ * Sets the budget for the endgame solver starting now: it may use
+ * 1/ENDGAMETIMESPLIT of the remaining time, or half of a fixed move time
+ * so that a failed solve leaves the search the other half.
+ */
+void TimeManager::allocateEndgame(int msLeft) {
+    _budgetStart = chrono::steady_clock::now();
+    if (_moveTime > 0) {
+        allocateFixed(_moveTime / 2.0);
+        return;
+    }
+    _limited = (msLeft > 0);
+    if (!_limited) {
+        return;
+    }
+
+    _target = _hard = max(msLeft - SAFETYMS, msLeft / 2) / ENDGAMETIMESPLIT;
+    _hardDeadline = _budgetStart + chrono::microseconds((long long)(_hard * 1000));
+}
+
+/*
+ * Sets a budget of exactly ms from now, which is both the target and the
+ * hard deadline.
+ */
+void TimeManager::allocateFixed(double ms) {
+    _limited = true;
+    _target = _hard = ms;
+    _hardDeadline = _budgetStart + chrono::microseconds((long long)(_hard * 1000));
+}
+
+/*
+ * Prints the move latency distribution: mean, median, tail percentiles,
+ * maximum and the number of moves that overran their hard deadline.
+ */
+void TimeManager::report(ostream &out) {
+    if (_latencies.empty()) {
+        return;
+    }
+    vector<double> sorted(_latencies);
+    sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (unsigned int i = 0; i < sorted.size(); i++) {
+        total += sorted[i];
+    }
+    int n = sorted.size();
+
+    out << "moves " << n
+        << " mean " << total / n << "ms"
+        << " p50 " << sorted[(n - 1) / 2] << "ms"
+        << " p90 " << sorted[(n - 1) * 90 / 100] << "ms"
+        << " p99 " << sorted[(n - 1) * 99 / 100] << "ms"
+        << " max " << sorted[n - 1] << "ms"
+        << " overruns " << _overruns << endl;
+}
@@ -0,0 +1,74 @@
+#ifndef __TIMEMANAGER_H__
+#define __TIMEMANAGER_H__
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// Milliseconds of the game clock we never plan to use.
+#define SAFETYMS 50
+// Our moves that the endgame solver phase is budgeted as, and the least
+// number of moves the remaining time is split over.
+#define ENDGAMEMOVES 6
+#define MINMOVESTOGO 8
+// The hard deadline is HARDFACTOR times the target, but never more than
+// 1/MAXSHARE of the remaining time.
+#define HARDFACTOR 3
+#define MAXSHARE 4
+// A new iteration is only started in the first 1/ITERATIONSHARE of the
+// target, since it will take several times as long as the last one.
+#define ITERATIONSHARE 2
+// Share of the remaining time the endgame solver may use.
+#define ENDGAMETIMESPLIT 6
+// Milliseconds past the hard deadline after which a move is an overrun.
+#define OVERRUNMS 10
+
+/*
+ * Wall-clock time manager. For each move it sets a target time, after
+ * which no new iteration is started, and a hard deadline at which the
+ * running search is stopped. The budget depends on the game phase and
+ * on how many moves we still have to play before the endgame solver
+ * takes over. It also records how long every move took.
+ */
+class TimeManager {
+
+private:
+    std::chrono::steady_clock::time_point _moveStart;
+    std::chrono::steady_clock::time_point _budgetStart;
+    std::chrono::steady_clock::time_point _hardDeadline;
+    bool _limited;
+    int _moveTime;
+    double _target;
+    double _hard;
+
+    std::vector<double> _latencies;
+    int _overruns;
+
+    double since(std::chrono::steady_clock::time_point start);
+    void allocateFixed(double ms);
+
+public:
+    TimeManager();
+
+    void beginMove();
+    void endMove();
+    void allocate(int msLeft, int empties, int endgameEmpties);
+    void allocateEndgame(int msLeft);
+    // A fixed time per move instead of a share of the clock; 0 turns it off.
+    void setMoveTime(int ms) { _moveTime = ms; }
+
+    double elapsed() { return since(_budgetStart); }
+    double moveElapsed() { return since(_moveStart); }
+    double target() { return _target; }
+    bool limited() { return _limited; }
+    bool canStartIteration() { return !_limited || elapsed() < _target / ITERATIONSHARE; }
+    bool hardExpired() {
+        return _limited && std::chrono::steady_clock::now() >= _hardDeadline;
+    }
+    std::chrono::steady_clock::time_point hardDeadline() { return _hardDeadline; }
+    int overruns() { return _overruns; }
+
+    void report(std::ostream &out);
+};
+
+#endif
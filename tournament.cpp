@@ -0,0 +1,442 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "player.h"
+#include "book.h"
+#include "gamerecord.h"
+using namespace std;
+
+// Defaults: games at most, plies of random play per generated opening,
+// and the SPRT hypotheses (Elo of engine A over engine B) and error rates.
+#define MAXGAMES 1000
+#define OPENINGPLIES 8
+#define SPRTELO0 0.0
+#define SPRTELO1 10.0
+#define SPRTALPHA 0.05
+#define SPRTBETA 0.05
+#define TOURNAMENTHASHMB 16
+
+// Plays two Player configurations against each other in-process, many
+// games at a time. Each opening is played twice with the colours
+// swapped. After every game the Elo difference is updated and a
+// sequential probability ratio test decides whether A is at least
+// elo1 better than B (H1) or no better than elo0 (H0); the tournament
+// stops as soon as either is accepted, or after the maximum number of
+// games.
+//
+// Usage: tournament [-a spec] [-b spec] [-games n] [-concurrency n]
+//                   [-openings file | -plies n] [-seed n]
+//                   [-sprt elo0 elo1 alpha beta] [-stats file] [-record file]
+//
+// An engine spec is a comma-separated list of key=value settings:
+// depth, time (ms per game, 0 for fixed depth), threads, hash (MB),
+// endgame (empties), and book, weights and probcut (a file, or "none").
+// engine=mcts plays Monte Carlo tree search instead of alpha-beta, with
+// playouts=light (the default) or random. id is the player id the
+// engine's games are recorded under (A is 1 and B is 2 by default).
+// An openings file has one position per line: 64 characters of b, w or
+// . and the side to move, b or w. With -stats, every player writes its
+// per-move search statistics to the file as JSON lines. With -record,
+// every game is appended to the file in the format of gamerecord.h, from
+// the standard start when the opening was generated.
+
+struct Engine {
+    int depth;
+    int ms;
+    int threads;
+    int hash;
+    int endgame;
+    string book;
+    string weights;
+    string probCut;
+    int engine;
+    bool light;
+    int id;
+};
+
+// A generated opening keeps the moves that led to it.
+struct Opening {
+    char data[64];
+    Side side;
+    vector<uint8_t> moves;
+};
+
+static Engine engines[2];
+static vector<Opening> openings;
+static int maxGames = MAXGAMES;
+static FILE *statsLog = NULL;
+static GameRecordWriter recorder;
+static bool recording = false;
+static double elo0 = SPRTELO0, elo1 = SPRTELO1, alpha = SPRTALPHA, beta = SPRTBETA;
+
+static atomic<int> nextGame(0);
+static atomic<bool> stopping(false);
+static mutex resultsLock;
+static int wins, draws, losses, played;
+
+static inline Side other(Side s) {
+    return (s == BLACK) ? WHITE : BLACK;
+}
+
+static bool parseEngine(const char *spec, Engine &e) {
+    string s(spec);
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) end = s.size();
+        string item = s.substr(start, end - start);
+        size_t eq = item.find('=');
+        if (eq == string::npos) return false;
+        string key = item.substr(0, eq), value = item.substr(eq + 1);
+        int n = atoi(value.c_str());
+        if (key == "depth") e.depth = n;
+        else if (key == "time") e.ms = n;
+        else if (key == "threads") e.threads = n;
+        else if (key == "hash") e.hash = n;
+        else if (key == "endgame") e.endgame = n;
+        else if (key == "book") e.book = value;
+        else if (key == "weights") e.weights = value;
+        else if (key == "probcut") e.probCut = value;
+        else if (key == "engine") e.engine = (value == "mcts") ? ENGINEMCTS : ENGINEALPHABETA;
+        else if (key == "playouts") e.light = (value != "random");
+        else if (key == "id") e.id = n;
+        else return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+static Player *makePlayer(const Engine &e, Side side) {
+    Player *p = new Player(side, NULL, e.engine);
+    p->setThreads(e.threads);
+    p->setHashSize(e.hash);
+    p->setSearchDepth(e.depth);
+    p->setEndgameEmpties(e.endgame);
+    p->setBook(e.book == "none" ? NULL : e.book.c_str());
+    p->setWeights(e.weights == "none" ? NULL : e.weights.c_str());
+    p->setProbCut(e.probCut == "none" ? NULL : e.probCut.c_str());
+    p->setLightPlayouts(e.light);
+    p->setStatsLog(statsLog);
+    return p;
+}
+
+static bool loadOpenings(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char board[65], side[2];
+    while (fscanf(f, "%64s %1s", board, side) == 2) {
+        if (strlen(board) != 64) continue;
+        Opening o;
+        memcpy(o.data, board, 64);
+        o.side = (side[0] == 'w') ? WHITE : BLACK;
+        openings.push_back(o);
+    }
+    fclose(f);
+    return !openings.empty();
+}
+
+/*
+ * Distinct openings from random play, told apart by their canonical
+ * image so that no two are the same position turned around.
+ */
+static void generateOpenings(int count, int plies) {
+    vector<pair<uint64_t, uint64_t> > seen;
+    int attempts = 0;
+    while ((int) openings.size() < count && attempts++ < count * 100) {
+        Board board;
+        Side side = BLACK;
+        bool ok = true;
+        vector<uint8_t> played;
+        for (int ply = 0; ply < plies && ok; ply++) {
+            uint64_t moves = board.getPossibleMoves(side);
+            if (moves == 0) {
+                ok = false;
+                break;
+            }
+            for (int k = rand() % __builtin_popcountll(moves); k > 0; k--) {
+                moves &= moves - 1;
+            }
+            played.push_back(__builtin_ctzll(moves));
+            board.makeMove(__builtin_ctzll(moves), side);
+            side = other(side);
+        }
+        if (!ok || !board.hasMoves(side)) continue;
+
+        Opening o;
+        board.getBoard(o.data);
+        o.side = side;
+        uint64_t P = 0, O = 0;
+        for (int sq = 0; sq < 64; sq++) {
+            if (o.data[sq] == (side == BLACK ? 'b' : 'w')) P |= 1ULL << sq;
+            else if (o.data[sq] != ' ') O |= 1ULL << sq;
+        }
+        OpeningBook::canonicalize(P, O);
+        pair<uint64_t, uint64_t> key(P, O);
+        if (find(seen.begin(), seen.end(), key) != seen.end()) continue;
+        seen.push_back(key);
+        o.moves = played;
+        openings.push_back(o);
+    }
+}
+
+/*
+ * Plays one game and returns black's disc lead. A side that makes an
+ * illegal move, passes when it could move, or runs out of time loses
+ * 64-0; forfeit names it. The squares played are added to moves.
+ */
+static int playGame(Player *players[2], const Engine *config[2], const Opening &o,
+                    const char *&forfeit, vector<uint8_t> &moves) {
+    Board board;
+    char data[64];
+    memcpy(data, o.data, 64);
+    board.setBoard(data);
+    players[BLACK]->setBoard(data);
+    players[WHITE]->setBoard(data);
+
+    long clock[2] = { config[WHITE]->ms, config[BLACK]->ms };
+    Side turn = o.side;
+    Move *last = NULL;
+    forfeit = NULL;
+    while (!board.isDone()) {
+        bool timed = config[turn]->ms > 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Move *m = players[turn]->doMove(last, timed ? (int) clock[turn] : -1);
+        clock[turn] -= chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - start).count();
+        delete last;
+        last = m;
+
+        if (timed && clock[turn] < 0) forfeit = "time";
+        else if (m == NULL && board.hasMoves(turn)) forfeit = "pass";
+        else if (m != NULL && !board.checkMove(m, turn)) forfeit = "illegal move";
+        if (forfeit) {
+            delete last;
+            return (turn == BLACK) ? -64 : 64;
+        }
+        if (m != NULL) {
+            board.doMove(m, turn);
+            moves.push_back(m->x + 8 * m->y);
+        }
+        turn = other(turn);
+    }
+    delete last;
+    return board.countBlack() - board.countWhite();
+}
+
+/*
+ * Appends a finished game to the record file, from the standard start if
+ * the opening was generated and from the opening position otherwise. A
+ * forfeit is marked, so that its 64-0 is not read as a real result.
+ */
+static void recordGame(const Opening &o, const Engine *config[2], vector<uint8_t> &moves,
+                       int lead, bool forfeit) {
+    GameRecord game;
+    game.black = config[BLACK]->id;
+    game.white = config[WHITE]->id;
+    game.result = lead;
+    game.forfeit = forfeit;
+    game.standardStart = !o.moves.empty();
+    if (game.standardStart) {
+        moves.insert(moves.begin(), o.moves.begin(), o.moves.end());
+        game.firstSide = BLACK;
+    } else {
+        char data[64];
+        memcpy(data, o.data, 64);
+        Board start;
+        start.setBoard(data);
+        game.startBlack = start.own<BLACK>();
+        game.startWhite = start.own<WHITE>();
+        game.firstSide = o.side;
+    }
+    game.moves = moves.data();
+    game.count = moves.size();
+    if (!recorder.append(game)) {
+        fprintf(stderr, "cannot record game\n");
+    }
+}
+
+/*
+ * Expected score of a player rated elo above its opponent.
+ */
+static double expectedScore(double elo) {
+    return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+/*
+ * Elo estimate with a 95% interval, and the log-likelihood ratio of
+ * H1 over H0 under the normal approximation of the mean game score.
+ */
+static void statistics(double &elo, double &margin, double &llr) {
+    double n = wins + draws + losses;
+    double score = (wins + 0.5 * draws) / n;
+    double variance = (wins * (1 - score) * (1 - score) + draws * (0.5 - score) * (0.5 - score)
+                       + losses * score * score) / n;
+    double clamped = min(max(score, 0.001), 0.999);
+    elo = -400.0 * log10(1.0 / clamped - 1.0);
+
+    double se = sqrt(variance / n);
+    double high = min(clamped + 1.96 * se, 0.999), low = max(clamped - 1.96 * se, 0.001);
+    margin = (-400.0 * log10(1.0 / high - 1.0) + 400.0 * log10(1.0 / low - 1.0)) / 2;
+
+    double s0 = expectedScore(elo0), s1 = expectedScore(elo1);
+    llr = (variance > 0) ? (s1 - s0) * (2 * score - s0 - s1) / (2 * variance / n) : 0;
+}
+
+static void worker() {
+    // Players for every engine and colour, reused from game to game.
+    Player *players[2][2];
+    for (int e = 0; e < 2; e++) {
+        players[e][WHITE] = makePlayer(engines[e], WHITE);
+        players[e][BLACK] = makePlayer(engines[e], BLACK);
+    }
+
+    double lower = log(beta / (1 - alpha)), upper = log((1 - beta) / alpha);
+    int g;
+    while (!stopping && (g = nextGame++) < maxGames) {
+        // Engine A plays black in even games and white in odd ones.
+        const Opening &o = openings[(g / 2) % openings.size()];
+        Side sideA = (g % 2 == 0) ? BLACK : WHITE;
+        Player *seats[2];
+        const Engine *config[2];
+        seats[sideA] = players[0][sideA];
+        seats[other(sideA)] = players[1][other(sideA)];
+        config[sideA] = &engines[0];
+        config[other(sideA)] = &engines[1];
+
+        const char *forfeit;
+        vector<uint8_t> moves;
+        int lead = playGame(seats, config, o, forfeit, moves);
+        int leadA = (sideA == BLACK) ? lead : -lead;
+        if (recording) {
+            recordGame(o, config, moves, lead, forfeit != NULL);
+        }
+
+        lock_guard<mutex> lock(resultsLock);
+        if (leadA > 0) wins++;
+        else if (leadA < 0) losses++;
+        else draws++;
+        played++;
+
+        double elo, margin, llr;
+        statistics(elo, margin, llr);
+        printf("game %4d  A %s %+3d%s%s  +%d =%d -%d  elo %+.1f +/- %.1f  llr %.2f (%.2f, %.2f)\n",
+               g + 1, sideA == BLACK ? "black" : "white", leadA,
+               forfeit ? "  forfeit: " : "", forfeit ? forfeit : "",
+               wins, draws, losses, elo, margin, llr, lower, upper);
+        fflush(stdout);
+        if (!stopping && (llr >= upper || llr <= lower)) {
+            stopping = true;
+            printf("SPRT: %s accepted after %d games\n",
+                   llr >= upper ? "H1 (A is stronger)" : "H0 (A is not stronger)", played);
+        }
+    }
+
+    for (int e = 0; e < 2; e++) {
+        delete players[e][WHITE];
+        delete players[e][BLACK];
+    }
+}
+
+int main(int argc, char *argv[]) {
+    for (int e = 0; e < 2; e++) {
+        engines[e].depth = MINIMAXDEPTH;
+        engines[e].ms = 0;
+        engines[e].threads = 1;
+        engines[e].hash = TOURNAMENTHASHMB;
+        engines[e].endgame = ENDGAMEEMPTIES;
+        engines[e].book = "none";
+        engines[e].weights = EVALFILE;
+        engines[e].probCut = PROBCUTFILE;
+        engines[e].engine = ENGINEALPHABETA;
+        engines[e].light = true;
+        engines[e].id = e + 1;
+    }
+    int concurrency = max((int) thread::hardware_concurrency(), 1);
+    int plies = OPENINGPLIES;
+    const char *openingFile = NULL;
+    srand(2015);
+
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        bool more = i + 1 < argc;
+        if ((arg == "-a" || arg == "-b") && more) {
+            if (!parseEngine(argv[++i], engines[arg == "-b"])) {
+                fprintf(stderr, "bad engine spec: %s\n", argv[i]);
+                return 2;
+            }
+        } else if (arg == "-games" && more) {
+            maxGames = atoi(argv[++i]);
+        } else if (arg == "-concurrency" && more) {
+            concurrency = max(atoi(argv[++i]), 1);
+        } else if (arg == "-openings" && more) {
+            openingFile = argv[++i];
+        } else if (arg == "-plies" && more) {
+            plies = atoi(argv[++i]);
+        } else if (arg == "-seed" && more) {
+            srand(atoi(argv[++i]));
+        } else if (arg == "-sprt" && i + 4 < argc) {
+            elo0 = atof(argv[++i]);
+            elo1 = atof(argv[++i]);
+            alpha = atof(argv[++i]);
+            beta = atof(argv[++i]);
+        } else if (arg == "-stats" && more) {
+            statsLog = fopen(argv[++i], "w");
+            if (!statsLog) {
+                fprintf(stderr, "cannot write %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "-record" && more) {
+            recording = recorder.open(argv[++i]);
+            if (!recording) {
+                fprintf(stderr, "cannot record games to %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-a spec] [-b spec] [-games n] [-concurrency n] "
+                    "[-openings file | -plies n] [-seed n] [-sprt elo0 elo1 alpha beta] "
+                    "[-stats file] [-record file]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (openingFile) {
+        if (!loadOpenings(openingFile)) {
+            fprintf(stderr, "no openings in %s\n", openingFile);
+            return 1;
+        }
+    } else {
+        generateOpenings((maxGames + 1) / 2, plies);
+    }
+    printf("%d games at most, %lu openings, %d at a time, SPRT elo0 %.1f elo1 %.1f\n",
+           maxGames, (unsigned long) openings.size(), concurrency, elo0, elo1);
+
+    vector<thread> workers;
+    for (int i = 0; i < concurrency; i++) {
+        workers.push_back(thread(worker));
+    }
+    for (unsigned int i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+
+    if (played > 0) {
+        double elo, margin, llr;
+        statistics(elo, margin, llr);
+        printf("A vs B: +%d =%d -%d in %d games, elo %+.1f +/- %.1f\n",
+               wins, draws, losses, played, elo, margin);
+    }
+    if (statsLog) {
+        fclose(statsLog);
+    }
+    if (recording && !recorder.close()) {
+        fprintf(stderr, "cannot record games\n");
+        return 1;
+    }
+    return 0;
+}
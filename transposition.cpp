@@ -0,0 +1,143 @@
+#include <cstdlib>
+#include <new>
+#include "transposition.h"
+
+using namespace std;
+
+/*
+ * Packs an entry into one 64-bit word and back.
+ */
+static inline uint64_t pack(int score, int depth, int bound, int move, int age) {
+    return (uint64_t)(uint32_t) score
+         | ((uint64_t) depth << 32)
+         | ((uint64_t) bound << 40)
+         | ((uint64_t) move << 48)
+         | ((uint64_t) age << 56);
+}
+
+static inline TTEntry unpack(uint64_t data) {
+    TTEntry entry;
+    entry.score = (int32_t)(uint32_t) data;
+    entry.depth = (uint8_t)(data >> 32);
+    entry.bound = (uint8_t)(data >> 40);
+    entry.move = (uint8_t)(data >> 48);
+    entry.age = (uint8_t)(data >> 56);
+    return entry;
+}
+
+/*
+ * Creates a table using at most the given number of megabytes.
+ */
+TranspositionTable::TranspositionTable(size_t megabytes) : _buckets(NULL) {
+    resize(megabytes);
+}
+
+/*
+ * Destructor for the table.
+ */
+TranspositionTable::~TranspositionTable() {
+    free(_buckets);
+}
+
+/*
+ * Reallocates the table with the largest power-of-two number of buckets
+ * that fits in the given number of megabytes, and clears it. Must not be
+ * called while a search is running.
+ */
+void TranspositionTable::resize(size_t megabytes) {
+    size_t count = 1;
+    while (2 * count * sizeof(TTBucket) <= megabytes * 1024 * 1024) {
+        count *= 2;
+    }
+
+    free(_buckets);
+    void *memory;
+    if (posix_memalign(&memory, sizeof(TTBucket), count * sizeof(TTBucket))) {
+        throw bad_alloc();
+    }
+    _buckets = (TTBucket *) memory;
+    for (size_t i = 0; i < count; i++) {
+        new (&_buckets[i]) TTBucket();
+    }
+    _mask = count - 1;
+    clear();
+}
+
+/*
+ * Empties the table.
+ */
+void TranspositionTable::clear() {
+    for (uint64_t i = 0; i <= _mask; i++) {
+        for (int j = 0; j < BUCKETSIZE; j++) {
+            _buckets[i].slots[j].check.store(0, memory_order_relaxed);
+            _buckets[i].slots[j].data.store(0, memory_order_relaxed);
+        }
+    }
+    _age.store(0, memory_order_relaxed);
+}
+
+/*
+ * Marks the start of a new search. Entries from earlier searches stay
+ * usable but are the first to be replaced. Safe to call while other
+ * threads probe and store.
+ */
+void TranspositionTable::newSearch() {
+    _age.fetch_add(1, memory_order_relaxed);
+}
+
+/*
+ * Looks up key, copying its entry out and returning true on a hit.
+ */
+bool TranspositionTable::probe(uint64_t key, TTEntry &entry) {
+    TTBucket &bucket = _buckets[key & _mask];
+    for (int i = 0; i < BUCKETSIZE; i++) {
+        uint64_t data = bucket.slots[i].data.load(memory_order_relaxed);
+        uint64_t check = bucket.slots[i].check.load(memory_order_relaxed);
+        if ((check ^ data) == key) {
+            entry = unpack(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Stores a search result. An existing entry for the same position is
+ * overwritten unless it came from a deeper search in the current one;
+ * otherwise the bucket gives up its emptiest slot: entries from older
+ * searches go first, then the shallowest.
+ */
+void TranspositionTable::store(uint64_t key, int depth, int bound,
+                               int score, int move) {
+    TTBucket &bucket = _buckets[key & _mask];
+    TTSlot *replace = &bucket.slots[0];
+    int worst = INT32_MAX;
+    uint8_t age = _age.load(memory_order_relaxed);
+
+    for (int i = 0; i < BUCKETSIZE; i++) {
+        TTSlot *slot = &bucket.slots[i];
+        uint64_t data = slot->data.load(memory_order_relaxed);
+        uint64_t check = slot->check.load(memory_order_relaxed);
+        TTEntry e = unpack(data);
+
+        if ((check ^ data) == key) {
+            if (e.age == age && e.depth > depth && bound != BOUND_EXACT) {
+                return;
+            }
+            if (move == NOMOVE) move = e.move;
+            replace = slot;
+            break;
+        }
+
+        int worth = (check == 0 && data == 0) ? -1
+                  : e.depth + ((e.age == age) ? 256 : 0);
+        if (worth < worst) {
+            worst = worth;
+            replace = slot;
+        }
+    }
+
+    uint64_t data = pack(score, depth, bound, move, age);
+    replace->data.store(data, memory_order_relaxed);
+    replace->check.store(key ^ data, memory_order_relaxed);
+}
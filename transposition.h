@@ -0,0 +1,68 @@
+#ifndef __TRANSPOSITION_H__
+#define __TRANSPOSITION_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Kinds of score an entry can hold.
+#define BOUND_EXACT 0
+#define BOUND_LOWER 1
+#define BOUND_UPPER 2
+
+// Entries per bucket; one bucket fills a 64-byte cache line.
+#define BUCKETSIZE 4
+
+#define NOMOVE 0xff
+
+struct TTEntry {
+    int32_t score;
+    uint8_t depth;
+    uint8_t bound;
+    uint8_t move;
+    uint8_t age;
+};
+
+/*
+ * One slot as stored in the table: the entry packed into a single word,
+ * and the key xor'd with that word. Threads read and write slots without
+ * locking; a slot torn by two concurrent writers no longer xors back to
+ * its key, so a probe simply misses it.
+ */
+struct TTSlot {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data;
+};
+
+struct alignas(64) TTBucket {
+    TTSlot slots[BUCKETSIZE];
+};
+
+/*
+ * Fixed-size transposition table keyed by Zobrist hashes. The table is a
+ * power-of-two array of cache-line buckets; a position only ever looks at
+ * its own bucket. Probes and stores are safe to call from any number of
+ * search threads at once.
+ */
+class TranspositionTable {
+
+private:
+    TTBucket *_buckets;
+    uint64_t _mask;
+    std::atomic<uint8_t> _age;
+
+public:
+    TranspositionTable(size_t megabytes);
+    ~TranspositionTable();
+
+    void resize(size_t megabytes);
+    void clear();
+    void newSearch();
+
+    bool probe(uint64_t key, TTEntry &entry);
+    void store(uint64_t key, int depth, int bound, int score, int move);
+
+    size_t size() { return (_mask + 1) * BUCKETSIZE; }
+};
+
+#endif
@@ -0,0 +1,353 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "eval.h"
+#include "gamerecord.h"
+using namespace std;
+
+// Defaults: passes over the data, how many games are handed to a thread
+// at a time, and one game in how many is held out to measure the error
+// on positions the fit has not seen.
+#define TUNEPASSES 30
+#define TUNECHUNK 256
+#define TUNEHOLDOUT 10
+// Ridge penalty on every weight's distance from its starting value, in
+// positions' worth of squared features, so that weights seen in only a
+// few positions move less.
+#define TUNERIDGE 20.0
+
+// Fits the evaluation weights to the results of recorded games. Every
+// position a side moved from is labelled with the game's final disc
+// lead for that side, in hundredths of a disc, and the weights of all
+// EVALPHASES phases (the pattern tables, mobility and the constant) are
+// fitted to those labels by ridge regression towards the starting
+// weights. The fit is conjugate gradient on the normal
+// equations, preconditioned by every weight's sum of squared features;
+// it needs no step size, and each step takes one pass over the data.
+// Each pass replays the game files again, so any number of games can be
+// used: the files are mapped, split into chunks of games, and every
+// thread replays its own chunks through Board, extracts features with
+// the Evaluator and adds up its own sums.
+//
+// Games decided by a forfeit are skipped, since their 64-0 says nothing
+// about the positions. Every TUNEHOLDOUT-th game is held out. After every pass the tool
+// prints both errors as root mean square discs and the positions
+// replayed per second per thread. The weights are written with
+// Evaluator::save() whenever the held-out error improves, so the output
+// file is always the best fit so far. Player loads it at startup as
+// EVALFILE (or through setWeights()), so no rebuild is needed.
+//
+// Usage: tune [-passes n] [-threads n] [-ridge r] [-holdout n]
+//             [-weights file] [-out file] games...
+
+struct Chunk {
+    int file;
+    size_t offset;
+    uint64_t firstGame;
+    int games;
+};
+
+/*
+ * One thread's sums for a pass over the training positions, with X
+ * their features, e their errors and p the search direction. The first
+ * pass adds up X'e in product and every weight's squared features in
+ * square; the others add up X'Xp in product and |Xp|^2 in
+ * directionSquare. Every pass adds up the squared errors of both sets
+ * of positions.
+ */
+struct Sums {
+    vector<double> product;
+    vector<double> square;
+    double directionSquare;
+    double trainError, testError;
+    uint64_t trainPositions, testPositions;
+
+    Sums() : product(EVALPHASES * EVALWEIGHTS), square(EVALPHASES * EVALWEIGHTS) {}
+
+    void clear() {
+        fill(product.begin(), product.end(), 0.0);
+        fill(square.begin(), square.end(), 0.0);
+        directionSquare = trainError = testError = 0;
+        trainPositions = testPositions = 0;
+    }
+};
+
+static vector<const char *> files;
+static vector<Chunk> chunks;
+static vector<double> weights;
+static vector<double> direction;
+static int holdout = TUNEHOLDOUT;
+
+/*
+ * Splits the game files into chunks of TUNECHUNK games. Returns false if
+ * a file cannot be read; a damaged record ends its file with a warning.
+ */
+static bool split(uint64_t &games) {
+    games = 0;
+    for (unsigned int f = 0; f < files.size(); f++) {
+        GameReader reader;
+        if (!reader.open(files[f])) {
+            fprintf(stderr, "%s: not a game file\n", files[f]);
+            return false;
+        }
+        Chunk chunk;
+        chunk.file = f;
+        chunk.games = 0;
+        GameRecord game;
+        for (size_t offset = reader.offset(); reader.next(game); offset = reader.offset()) {
+            if (chunk.games == 0) {
+                chunk.offset = offset;
+                chunk.firstGame = games;
+            }
+            games++;
+            if (++chunk.games == TUNECHUNK) {
+                chunks.push_back(chunk);
+                chunk.games = 0;
+            }
+        }
+        if (chunk.games > 0) {
+            chunks.push_back(chunk);
+        }
+        if (reader.damaged()) {
+            fprintf(stderr, "%s: damaged record at byte %llu, ignoring the rest\n",
+                    files[f], (unsigned long long) reader.offset());
+        }
+    }
+    return true;
+}
+
+/*
+ * Replays the chunks of one thread (every threads-th chunk from id) and
+ * adds up the sums of every position in them.
+ */
+static void pass(int id, int threads, bool first, Sums *sums) {
+    sums->clear();
+    vector<GameReader> readers(files.size());
+    vector<bool> opened(files.size());
+    int indices[EVALINSTANCES];
+    for (unsigned int c = id; c < chunks.size(); c += threads) {
+        const Chunk &chunk = chunks[c];
+        GameReader &reader = readers[chunk.file];
+        if (!opened[chunk.file]) {
+            opened[chunk.file] = reader.open(files[chunk.file]);
+        }
+        reader.seek(chunk.offset);
+        GameRecord game;
+        for (int g = 0; g < chunk.games && reader.next(game); g++) {
+            // A forfeit's result says nothing about the positions.
+            if (game.forfeit) {
+                continue;
+            }
+            bool test = holdout > 0 && (chunk.firstGame + g) % holdout == 0;
+            for (GameReplay replay(game); !replay.done(); replay.next()) {
+                Board &b = replay.board();
+                Side s = replay.side();
+                uint64_t P = (s == BLACK) ? b.own<BLACK>() : b.own<WHITE>();
+                uint64_t O = (s == BLACK) ? b.own<WHITE>() : b.own<BLACK>();
+                double label = EVALSCALE * ((s == BLACK) ? game.result : -game.result);
+
+                int offset = Evaluator::phase(P, O) * EVALWEIGHTS;
+                const double *w = &weights[offset];
+                Evaluator::extract(P, O, indices);
+                int mobility = Evaluator::mobility(P, O);
+                double predicted = w[BIASWEIGHT] + w[MOBILITYWEIGHT] * mobility;
+                for (int i = 0; i < EVALINSTANCES; i++) {
+                    predicted += w[indices[i]];
+                }
+                double error = label - predicted;
+                if (test) {
+                    sums->testError += error * error;
+                    sums->testPositions++;
+                    continue;
+                }
+                sums->trainError += error * error;
+                sums->trainPositions++;
+
+                double *product = &sums->product[offset];
+                if (first) {
+                    double *square = &sums->square[offset];
+                    for (int i = 0; i < EVALINSTANCES; i++) {
+                        product[indices[i]] += error;
+                        square[indices[i]] += 1;
+                    }
+                    product[BIASWEIGHT] += error;
+                    square[BIASWEIGHT] += 1;
+                    product[MOBILITYWEIGHT] += error * mobility;
+                    square[MOBILITYWEIGHT] += mobility * mobility;
+                    continue;
+                }
+
+                const double *p = &direction[offset];
+                double q = p[BIASWEIGHT] + p[MOBILITYWEIGHT] * mobility;
+                for (int i = 0; i < EVALINSTANCES; i++) {
+                    q += p[indices[i]];
+                }
+                sums->directionSquare += q * q;
+                for (int i = 0; i < EVALINSTANCES; i++) {
+                    product[indices[i]] += q;
+                }
+                product[BIASWEIGHT] += q;
+                product[MOBILITYWEIGHT] += q * mobility;
+            }
+        }
+    }
+}
+
+/*
+ * Rounds the fitted weights into the evaluator and writes them out.
+ */
+static bool save(Evaluator &eval, const char *path) {
+    for (int phase = 0; phase < EVALPHASES; phase++) {
+        int16_t *w = eval.weights(phase);
+        for (int i = 0; i < EVALWEIGHTS; i++) {
+            double value = weights[phase * EVALWEIGHTS + i];
+            w[i] = (int16_t) lround(max(-32767.0, min(value, 32767.0)));
+        }
+    }
+    return eval.save(path);
+}
+
+int main(int argc, char *argv[]) {
+    int passes = TUNEPASSES;
+    int threads = max((int) thread::hardware_concurrency(), 1);
+    double ridge = TUNERIDGE;
+    const char *start = NULL;
+    const char *out = EVALFILE;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (!strcmp(argv[i], "-passes") && more) {
+            passes = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            threads = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-ridge") && more) {
+            ridge = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-holdout") && more) {
+            holdout = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-weights") && more) {
+            start = argv[++i];
+        } else if (!strcmp(argv[i], "-out") && more) {
+            out = argv[++i];
+        } else if (argv[i][0] != '-') {
+            files.push_back(argv[i]);
+        } else {
+            files.clear();
+            break;
+        }
+    }
+    if (files.empty()) {
+        fprintf(stderr, "usage: %s [-passes n] [-threads n] [-ridge r] [-holdout n] "
+                "[-weights file] [-out file] games...\n", argv[0]);
+        return 2;
+    }
+
+    // Start from the given weights, or from the defaults.
+    Evaluator eval;
+    if (start && !eval.load(start)) {
+        fprintf(stderr, "cannot read weights from %s\n", start);
+        return 1;
+    }
+    size_t size = EVALPHASES * EVALWEIGHTS;
+    weights.resize(size);
+    direction.resize(size);
+    for (int phase = 0; phase < EVALPHASES; phase++) {
+        copy(eval.weights(phase), eval.weights(phase) + EVALWEIGHTS,
+             &weights[phase * EVALWEIGHTS]);
+    }
+
+    uint64_t games;
+    if (!split(games)) {
+        return 1;
+    }
+    printf("%llu games in %lu chunks, %d threads\n", (unsigned long long) games,
+           (unsigned long) chunks.size(), threads);
+
+    // Conjugate gradient state: the residual of the normal equations,
+    // the preconditioner and their product.
+    vector<double> residual(size), diagonal(size);
+    double rz = 0;
+    vector<Sums> sums(threads);
+    double bestTest = HUGE_VAL;
+    for (int n = 1; n <= passes; n++) {
+        bool first = (n == 1);
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        vector<thread> pool;
+        for (int id = 1; id < threads; id++) {
+            pool.push_back(thread(pass, id, threads, first, &sums[id]));
+        }
+        pass(0, threads, first, &sums[0]);
+        for (unsigned int i = 0; i < pool.size(); i++) {
+            pool[i].join();
+        }
+
+        Sums &total = sums[0];
+        for (int id = 1; id < threads; id++) {
+            for (size_t i = 0; i < size; i++) {
+                total.product[i] += sums[id].product[i];
+                total.square[i] += sums[id].square[i];
+            }
+            total.directionSquare += sums[id].directionSquare;
+            total.trainError += sums[id].trainError;
+            total.testError += sums[id].testError;
+            total.trainPositions += sums[id].trainPositions;
+            total.testPositions += sums[id].testPositions;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        double train = sqrt(total.trainError / max(total.trainPositions, (uint64_t) 1)) / EVALSCALE;
+        double test = sqrt(total.testError / max(total.testPositions, (uint64_t) 1)) / EVALSCALE;
+        uint64_t positions = total.trainPositions + total.testPositions;
+        printf("pass %3d  train %.3f  test %.3f discs  %.0f positions/s/thread\n",
+               n, train, test, positions / seconds / threads);
+        fflush(stdout);
+
+        // The errors are those of the weights before this pass's step.
+        if (total.testPositions > 0 && test < bestTest) {
+            bestTest = test;
+            if (!save(eval, out)) {
+                perror(out);
+                return 1;
+            }
+        }
+        if (n == passes) {
+            break;
+        }
+
+        if (first) {
+            // The fit starts at the current weights, where the ridge term
+            // has no gradient.
+            for (size_t i = 0; i < size; i++) {
+                diagonal[i] = total.square[i] + ridge;
+                residual[i] = total.product[i];
+                direction[i] = residual[i] / diagonal[i];
+                rz += residual[i] * direction[i];
+            }
+            continue;
+        }
+        double curvature = total.directionSquare;
+        for (size_t i = 0; i < size; i++) {
+            curvature += ridge * direction[i] * direction[i];
+        }
+        if (curvature <= 0 || rz <= 0) {
+            break;
+        }
+        double alpha = rz / curvature, rzNext = 0;
+        for (size_t i = 0; i < size; i++) {
+            weights[i] += alpha * direction[i];
+            residual[i] -= alpha * (total.product[i] + ridge * direction[i]);
+            rzNext += residual[i] * residual[i] / diagonal[i];
+        }
+        double beta = rzNext / rz;
+        for (size_t i = 0; i < size; i++) {
+            direction[i] = residual[i] / diagonal[i] + beta * direction[i];
+        }
+        rz = rzNext;
+    }
+    if (holdout <= 0 && !save(eval, out)) {
+        perror(out);
+        return 1;
+    }
+    return 0;
+}
@@ -5,15 +5,28 @@
 using namespace std;
 
 int main(int argc, char *argv[]) {    
-    // Read in side the player is on.
-    if (argc != 2)  {
-        cerr << "usage: " << argv[0] << " side" << endl;
+    // Read in side the player is on, whether to think on the opponent's
+    // time, whether to log search statistics to stderr, and whether to
+    // search with MCTS.
+    bool ponder = false, stats = false, mcts = false;
+    bool ok = (argc >= 2);
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "ponder")) ponder = true;
+        else if (!strcmp(argv[i], "stats")) stats = true;
+        else if (!strcmp(argv[i], "mcts")) mcts = true;
+        else ok = false;
+    }
+    if (!ok)  {
+        cerr << "usage: " << argv[0] << " side [ponder] [stats] [mcts]" << endl;
         exit(-1);
     }
     Side side = (!strcmp(argv[1], "Black")) ? BLACK : WHITE;
 
     // Initialize player.
-    Player *player = new Player(side);
+    Player *player = new Player(side, NULL, mcts ? ENGINEMCTS : ENGINEALPHABETA);
+    if (stats) {
+        player->setStatsLog(stderr);
+    }
 
     // Tell java wrapper that we are done initializing.
     cout << "Init done" << endl;
@@ -38,10 +51,17 @@ int main(int argc, char *argv[]) {
         cout.flush();
         cerr.flush();
         
+        // Keep searching while the opponent thinks; the next doMove()
+        // stops the search and picks up what it found.
+        if (ponder) {
+            player->startPonder();
+        }
+        
         // Delete move objects.
         if (opponentsMove != NULL) delete opponentsMove;
         if (playersMove != NULL) delete playersMove; 
     }
 
+    delete player;
     return 0;
 }